@@ -0,0 +1,297 @@
+// -*- c++ -*-
+
+// Cycle counts for `glukeys::Plugin` on an ATmega32U4, run in simavr (`make simbench`).
+// The plugin is driven by the stand-in core from `extras/host`, and each measurement is
+// taken with Timer1 running at the CPU clock, so it's in CPU cycles. The cases are:
+//
+//   - `onKeyEvent()` on its common paths: a plain key with no glukeys active, a glukey
+//     press & release (becoming `sticky`), and the trigger key that releases it. These
+//     times include the stand-in controller's work for any events glukeys injects.
+//   - releasing N `sticky` glukeys at once (`deactivate()`, which is just
+//     `releaseGlukeys()`), and the scan that sends the queued releases. Past
+//     `max_active_glukeys` (8), the plugin has to find them by scanning its bitfields.
+//   - `preKeyswitchScan()`: idle, with timeouts running, with LED updates waiting, and
+//     with 8 timeouts expiring at once.
+//
+// Output goes to simavr's console, through GPIOR0. `make simbench` compares the mean & max
+// of each case with `bench_baseline.txt` (see `bench_check.py`).
+
+#include <Arduino.h>
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <stdio.h>
+
+#include <avr/avr_mcu_section.h>
+
+#include <kaleidoglyph/Controller.h>
+#include <kaleidoglyph/Key.h>
+#include <kaleidoglyph/KeyAddr.h>
+
+#include "glukeys/Glukeys.h"
+#include "HostCore.h"
+
+AVR_MCU(F_CPU, "atmega32u4");
+AVR_MCU_SIMAVR_CONSOLE(&GPIOR0);
+
+using namespace kaleidoglyph;
+
+// The cycle counter: Timer1, with no prescaler, extended to 32 bits by its overflow
+// interrupt
+volatile uint16_t timer1_overflows;
+
+ISR(TIMER1_OVF_vect) {
+  ++timer1_overflows;
+}
+
+void startCycleCounter() {
+  TCCR1A = 0;
+  TCCR1B = _BV(CS10);
+  TIMSK1 = _BV(TOIE1);
+  sei();
+}
+
+uint32_t cycleCount() {
+  uint8_t sreg = SREG;
+  cli();
+  uint16_t low  = TCNT1;
+  uint16_t high = timer1_overflows;
+  // An overflow that hasn't been handled yet (because interrupts are off)
+  if ((TIFR1 & _BV(TOV1)) && low < 0x8000) {
+    ++high;
+  }
+  SREG = sreg;
+  return (uint32_t(high) << 16) | low;
+}
+
+namespace {
+
+// Layer 0: letters at 0-25, modifier glukeys at 32-39, a layer-shift glukey at 40, and
+// table glukeys at 48-63
+constexpr byte letter_addr{0};
+constexpr byte modifier_glukey_addr{32};
+constexpr byte layer_glukey_addr{40};
+constexpr byte table_glukey_addr{48};
+constexpr byte table_glukey_count{16};
+
+const PROGMEM Key glukey_table[table_glukey_count] = {
+  KeyboardKey(0x04), KeyboardKey(0x05), KeyboardKey(0x06), KeyboardKey(0x07),
+  KeyboardKey(0x08), KeyboardKey(0x09), KeyboardKey(0x0A), KeyboardKey(0x0B),
+  KeyboardKey(0x0C), KeyboardKey(0x0D), KeyboardKey(0x0E), KeyboardKey(0x0F),
+  KeyboardKey(0x10), KeyboardKey(0x11), KeyboardKey(0x12), KeyboardKey(0x13),
+};
+
+Controller controller;
+glukeys::Plugin glukeys_plugin{glukey_table, controller};
+
+void setupKeymap() {
+  for (byte i = 0; i < 26; ++i) {
+    host::keymap[0][letter_addr + i] = KeyboardKey(byte(0x04 + i));
+    host::keymap[1][letter_addr + i] = KeyboardKey(byte(0x1E + i % 10));
+  }
+  for (byte i = 0; i < 8; ++i) {
+    host::keymap[0][modifier_glukey_addr + i] = glukeys::glukeysModifierKey(i);
+  }
+  host::keymap[0][layer_glukey_addr] = glukeys::glukeysLayerShiftKey(1);
+  for (byte i = 0; i < table_glukey_count; ++i) {
+    host::keymap[0][table_glukey_addr + i] = glukeys::GlukeysKey{i};
+  }
+}
+
+// The cycles spent reading the counter, which get subtracted from every measurement
+uint32_t counter_overhead;
+
+struct Stats {
+  uint16_t count;
+  uint32_t min;
+  uint32_t max;
+  uint32_t total;
+
+  void add(uint32_t cycles) {
+    cycles = (cycles > counter_overhead) ? cycles - counter_overhead : 0;
+    if (count == 0 || cycles < min) min = cycles;
+    if (cycles > max) max = cycles;
+    total += cycles;
+    ++count;
+  }
+
+  void print(const char* name_P) const {
+    printf_P(PSTR("%-36S %6u %8lu %8lu %8lu\n"), name_P, count,
+             min, count ? total / count : 0, max);
+  }
+  // The same, with the number of glukeys in the case appended to its name
+  void print(const char* name_P, byte n) const {
+    char name[40];
+    snprintf_P(name, sizeof(name), PSTR("%S, %u sticky"), name_P, n);
+    printf_P(PSTR("%-36s %6u %8lu %8lu %8lu\n"), name, count,
+             min, count ? total / count : 0, max);
+  }
+};
+
+// The stats for the next non-injected event to reach the plugin, if it's being measured
+Stats* event_stats{nullptr};
+
+EventHandlerResult onKeyEvent(KeyEvent& event) {
+  if (event_stats == nullptr || event.state.isInjected()) {
+    return glukeys_plugin.onKeyEvent(event);
+  }
+  Stats* stats = event_stats;
+  event_stats = nullptr;
+  uint32_t start = cycleCount();
+  EventHandlerResult result = glukeys_plugin.onKeyEvent(event);
+  stats->add(cycleCount() - start);
+  return result;
+}
+
+void scan(Stats* stats = nullptr) {
+  host::advanceTime(5);
+  uint32_t start = cycleCount();
+  glukeys_plugin.preKeyswitchScan();
+  uint32_t cycles = cycleCount() - start;
+  if (stats != nullptr) stats->add(cycles);
+}
+
+void press(byte k, Stats* stats = nullptr) {
+  scan();
+  event_stats = stats;
+  host::press(KeyAddr{k});
+}
+void release(byte k, Stats* stats = nullptr) {
+  scan();
+  event_stats = stats;
+  host::release(KeyAddr{k});
+}
+
+constexpr byte repetitions{32};
+
+void benchKeyEvents() {
+  Stats plain_press{}, plain_release{};
+  Stats glukey_press{}, glukey_release{};
+  Stats trigger_press{}, trigger_release{};
+  Stats layer_trigger_press{};
+
+  host::reset();
+  for (byte r = 0; r < repetitions; ++r) {
+    byte letter = letter_addr + r % 26;
+    press(letter, &plain_press);
+    release(letter, &plain_release);
+
+    byte modifier = modifier_glukey_addr + r % 8;
+    press(modifier, &glukey_press);
+    release(modifier, &glukey_release);
+    press(letter, &trigger_press);
+    release(letter, &trigger_release);
+
+    press(layer_glukey_addr);
+    release(layer_glukey_addr);
+    press(letter, &layer_trigger_press);
+    release(letter);
+  }
+
+  plain_press.print(PSTR("onKeyEvent: plain press (idle)"));
+  plain_release.print(PSTR("onKeyEvent: plain release (idle)"));
+  glukey_press.print(PSTR("onKeyEvent: glukey press"));
+  glukey_release.print(PSTR("onKeyEvent: glukey release (sticky)"));
+  trigger_press.print(PSTR("onKeyEvent: trigger press"));
+  trigger_release.print(PSTR("onKeyEvent: trigger release"));
+  layer_trigger_press.print(PSTR("onKeyEvent: layer shift trigger press"));
+}
+
+void benchReleaseGlukeys() {
+  static const byte counts[] PROGMEM = {1, 2, 4, 8, 12, 16};
+  for (byte c = 0; c < sizeof(counts); ++c) {
+    byte n = pgm_read_byte(&counts[c]);
+    Stats release_stats{}, flush_stats{};
+    host::reset();
+    for (byte r = 0; r < repetitions; ++r) {
+      for (byte i = 0; i < n; ++i) {
+        press(table_glukey_addr + i);
+        release(table_glukey_addr + i);
+      }
+      scan();
+      uint32_t start = cycleCount();
+      glukeys_plugin.deactivate();
+      release_stats.add(cycleCount() - start);
+      scan(&flush_stats);
+      glukeys_plugin.activate();
+    }
+    release_stats.print(PSTR("releaseGlukeys()"), n);
+    flush_stats.print(PSTR("preKeyswitchScan() after"), n);
+  }
+}
+
+void benchScans() {
+  Stats idle{}, timeouts{}, led_updates{}, expiring{};
+
+  host::reset();
+  glukeys_plugin.setTimeout(1000);
+  for (byte r = 0; r < repetitions; ++r) {
+    scan(&idle);
+  }
+  for (byte r = 0; r < repetitions; ++r) {
+    // All in one scan, so their LED updates are all waiting for the next one, and their
+    // timeouts all expire together
+    for (byte i = 0; i < 8; ++i) {
+      host::press(KeyAddr{byte(table_glukey_addr + i)});
+      host::release(KeyAddr{byte(table_glukey_addr + i)});
+    }
+    scan(&led_updates);
+    scan(&timeouts);
+    // Let them all expire in the same scan
+    host::advanceTime(1000);
+    scan(&expiring);
+    scan();
+  }
+  glukeys_plugin.setTimeout(0);
+
+  idle.print(PSTR("preKeyswitchScan: idle"));
+  led_updates.print(PSTR("preKeyswitchScan: 8 LED updates"));
+  timeouts.print(PSTR("preKeyswitchScan: 8 timeouts running"));
+  expiring.print(PSTR("preKeyswitchScan: 8 timeouts expiring"));
+}
+
+// simavr's console shows each byte written to GPIOR0. Depending on its version, it ends a
+// line at a carriage return or a newline, so each line gets both.
+int consolePutChar(char c, FILE*) {
+  if (c == '\n') {
+    GPIOR0 = '\r';
+  }
+  GPIOR0 = c;
+  return 0;
+}
+FILE console;
+
+} // namespace {
+
+
+// For the trace's event timer, in a build with `KALEIDOGLYPH_GLUKEYS_TRACE`
+unsigned long micros() {
+  return cycleCount() / (F_CPU / 1000000UL);
+}
+
+int main() {
+  // (`FDEV_SETUP_STREAM` uses designated initializers that C++ doesn't allow)
+  fdev_setup_stream(&console, consolePutChar, nullptr, _FDEV_SETUP_WRITE);
+  stdout = &console;
+  startCycleCounter();
+
+  uint32_t start = cycleCount();
+  counter_overhead = cycleCount() - start;
+
+  setupKeymap();
+  host::setEventHandler(onKeyEvent);
+
+  printf_P(PSTR("%-36S %6S %8S %8S %8S\n"), PSTR("cycles"), PSTR("count"),
+           PSTR("min"), PSTR("mean"), PSTR("max"));
+  benchKeyEvents();
+  benchReleaseGlukeys();
+  benchScans();
+
+  // simavr stops when the CPU goes to sleep with interrupts off
+  sleep_enable();
+  cli();
+  sleep_cpu();
+  return 0;
+}
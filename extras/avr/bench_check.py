@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+
+# Compare the cycle counts from a run of `bench.cpp` in simavr with the baseline file, and
+# exit with status 1 if any case's mean or max is more than `--threshold` percent over its
+# baseline, or if a case is missing from either of them. With `--write`, replace the
+# baseline with the numbers from the run instead.
+#
+# simavr prefixes the lines it shows from the console with `O:` (and may colour them), so
+# anything up to that is ignored: a case is any line that's left with a name and four
+# numbers (count, min, mean & max).
+
+import argparse
+import re
+import sys
+
+CASE = re.compile(r'^\s*(\S.*?)\s+(\d+)\s+(\d+)\s+(\d+)\s+(\d+)\s*$')
+ESCAPE = re.compile(r'\x1b\[[0-9;]*m')
+
+
+def read_run(path):
+    cases = {}
+    with open(path) as run:
+        for line in run:
+            match = CASE.match(ESCAPE.sub('', line).split('O:', 1)[-1])
+            if match:
+                name = match.group(1)
+                cases[name] = (int(match.group(4)), int(match.group(5)))
+    return cases
+
+
+def read_baseline(path):
+    cases = {}
+    with open(path) as baseline:
+        for line in baseline:
+            fields = line.split('#', 1)[0].split(None, 2)
+            if fields:
+                cases[fields[2].strip()] = (int(fields[0]), int(fields[1]))
+    return cases
+
+
+def write_baseline(path, cases, toolchain):
+    with open(path, 'w') as baseline:
+        baseline.write('# Cycle counts from `make simbench` (mean & max, then the case), that\n'
+                       '# later runs are checked against. Written by `make simbench-baseline`,\n'
+                       '# with: %s\n\n' % toolchain)
+        for name, (mean, maximum) in cases.items():
+            baseline.write('%8d %8d  %s\n' % (mean, maximum, name))
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--baseline', required=True)
+    parser.add_argument('--threshold', type=float, default=10,
+                        help='allowed increase over the baseline (percent)')
+    parser.add_argument('--write', action='store_true',
+                        help='replace the baseline with the numbers from this run')
+    parser.add_argument('--toolchain', default='',
+                        help='the compiler & simulator versions, for `--write`')
+    parser.add_argument('run', help="simavr's output")
+    args = parser.parse_args()
+
+    run = read_run(args.run)
+    if not run:
+        print('bench_check: no cycle counts in %s' % args.run)
+        return 1
+    if args.write:
+        write_baseline(args.baseline, run, args.toolchain)
+        return 0
+
+    baseline = read_baseline(args.baseline)
+    failed = False
+    for name, (mean, maximum) in run.items():
+        if name not in baseline:
+            print('bench_check: no baseline for "%s" (run `make simbench-baseline`)' % name)
+            failed = True
+            continue
+        for what, value, base in zip(('mean', 'max'), (mean, maximum), baseline[name]):
+            if value > base * (100 + args.threshold) / 100:
+                print('bench_check: "%s" %s is %d cycles, over %g%% more than its baseline '
+                      '(%d)' % (name, what, value, args.threshold, base))
+                failed = True
+    for name in baseline:
+        if name not in run:
+            print('bench_check: "%s" is in the baseline, but not in the run' % name)
+            failed = True
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,30 @@
+// -*- c++ -*-
+
+// A custom constants header (`KALEIDOGLYPH_GLUKEYS_CONSTANTS_H`) for the `constants`
+// footprint variant. The values are the same as the defaults, except for the key type,
+// and this one also defines its own packed modifier constants, so both of the optional
+// blocks in `GlukeysKey.h` get skipped.
+
+#pragma once
+
+#define KALEIDOGLYPH_GLUKEYS_PACKED_MODIFIER_CONSTANTS
+
+namespace kaleidoglyph {
+namespace glukeys {
+
+constexpr byte key_type_id{0b0000011};
+
+constexpr byte category_mask        { 0b11'000000 };
+constexpr byte layer_category_id    { 0b10'000000 };
+constexpr byte layer_mask           { 0b00'011111 };
+constexpr byte modifier_category_id { 0b11'000000 };
+constexpr byte modifier_mask        { 0b00'000111 };
+constexpr byte glukey_category_id   { 0b0'0000000 };
+constexpr byte glukey_mask          { 0b0'1111111 };
+
+constexpr byte packed_modifier_id            { 0b11'10'0000 };
+constexpr byte packed_modifier_category_mask { 0b11'11'0000 };
+constexpr byte packed_modifier_mask          { 0b00'00'1111 };
+
+} // namespace glukeys {
+} // namespace kaleidoglyph {
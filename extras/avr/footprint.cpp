@@ -0,0 +1,32 @@
+// -*- c++ -*-
+
+// A stand-in sketch for the footprint report: just the globals a keyboard's sketch would
+// have for glukeys, so the plugin's state is counted in `.bss`, and its constructor (and
+// the table) in `.text`/`.data`. The plugin's entry points are all out of line, so they
+// get compiled (and measured) whether or not anything here calls them.
+
+#include <Arduino.h>
+
+#include <kaleidoglyph/Controller.h>
+#include <kaleidoglyph/Key.h>
+
+#include "glukeys/Glukeys.h"
+#if defined(FOOTPRINT_LED_MODE)
+#include "glukeys/GlukeysLedMode.h"
+#endif
+
+using namespace kaleidoglyph;
+
+const PROGMEM Key glukey_table[] = {
+  KeyboardKey(0x2A),
+  KeyboardKey(0x2B),
+  KeyboardKey(0x39),
+  KeyboardKey(0x4C),
+};
+
+Controller controller;
+glukeys::Plugin glukeys_plugin{glukey_table, controller};
+
+#if defined(FOOTPRINT_LED_MODE)
+glukeys::LedMode glukeys_led_mode{glukeys_plugin};
+#endif
@@ -0,0 +1,270 @@
+#!/usr/bin/env python3
+
+# Report the footprint of one build of the plugin: the .text/.data/.bss sizes of its object
+# files (from `size`), and the worst-case stack depth of each entry point (from the
+# `-fstack-usage` frame sizes, and the call graph read from `objdump -dr` relocations).
+# Exits with status 1 if any of them is over the variant's budget in the budgets file, or if
+# the budgets were measured with a different compiler.
+#
+# With `--write-budgets`, it reads the numbers recorded (`--record`) for every variant, and
+# prints a new budgets file instead, with a small margin over each of them.
+#
+# The call graph only has direct calls. The plugin's calls to the core are external, so
+# they count for nothing (except the return address), apart from
+# `Controller::handleKeyEvent()`: it runs the event handlers, so it's treated as calling
+# `Plugin::onKeyEvent()` again, with a frame of `--controller-stack` bytes. That nested
+# call is always for an injected event, which `onKeyEvent()` returns from before it calls
+# anything that can get back to `handleKeyEvent()`, so there it only counts the callees
+# that can't. Any other cycle in the call graph is an error.
+
+import argparse
+import re
+import subprocess
+import sys
+
+
+def run(command):
+    return subprocess.run(command, check=True, capture_output=True, text=True).stdout
+
+
+def read_sizes(size_tool, objects):
+    # `size -t` (Berkeley format) ends with a totals line: text data bss dec hex filename
+    totals = run([size_tool, '-t'] + objects).splitlines()[-1].split()
+    return int(totals[0]), int(totals[1]), int(totals[2])
+
+
+def read_frames(su_files):
+    # Each line: file:line:column:name <tab> bytes <tab> qualifiers
+    frames = {}
+    dynamic = set()
+    for path in su_files:
+        with open(path) as su:
+            for line in su:
+                location, size, qualifiers = line.rstrip('\n').split('\t')
+                name = location.split(':', 3)[3]
+                frames[name] = int(size)
+                if 'dynamic' in qualifiers and 'bounded' not in qualifiers:
+                    dynamic.add(name)
+    return frames, dynamic
+
+
+def read_calls(objdump_tool, cxxfilt_tool, objects):
+    calls = {}
+    function = None
+    for path in objects:
+        for line in run([objdump_tool, '-dr', path]).splitlines():
+            header = re.match(r'^[0-9a-f]+ <(.+)>:$', line)
+            if header:
+                function = header.group(1)
+                calls.setdefault(function, set())
+                continue
+            reloc = re.match(r'^\s+[0-9a-f]+: R_\S+\s+(\S+?)(?:[+-]0x[0-9a-f]+)?$', line)
+            if reloc and function is not None:
+                target = reloc.group(1)
+                # A call to a local function can refer to its section instead
+                if target.startswith('.text.'):
+                    target = target[len('.text.'):]
+                if not target.startswith('.'):
+                    calls[function].add(target)
+
+    names = sorted(set(calls) | {t for targets in calls.values() for t in targets})
+    result = subprocess.run([cxxfilt_tool], input='\n'.join(names) + '\n',
+                            check=True, capture_output=True, text=True).stdout.splitlines()
+    demangle = dict(zip(names, result))
+    return {demangle[f]: {demangle[t] for t in targets} for f, targets in calls.items()}
+
+
+def frame_size(function, frames):
+    # `-fstack-usage` names include the return type, and `objdump` names don't
+    for name, size in frames.items():
+        if name == function or name.endswith(' ' + function):
+            return size, name
+    return None, None
+
+
+class Analysis:
+
+    def __init__(self, frames, dynamic, calls, args):
+        self.frames = frames
+        self.dynamic = dynamic
+        self.calls = calls
+        self.args = args
+        self.errors = []
+        self.handle_key_event = None
+        self.on_key_event = None
+        for function in calls:
+            if 'glukeys::Plugin::onKeyEvent(' in function:
+                self.on_key_event = function
+        for targets in calls.values():
+            for target in targets:
+                if 'Controller::handleKeyEvent(' in target:
+                    self.handle_key_event = target
+
+    def callees(self, function, nested):
+        if function == self.handle_key_event and self.on_key_event is not None:
+            return [self.on_key_event]
+        callees = sorted(self.calls.get(function, ()))
+        if nested:
+            callees = [f for f in callees if not self.reaches(f, self.handle_key_event, set())]
+        return callees
+
+    # Return `True` if `function` can call `target` (directly or not)
+    def reaches(self, function, target, seen):
+        if function == target:
+            return True
+        if function in seen:
+            return False
+        seen.add(function)
+        return any(self.reaches(f, target, seen) for f in self.calls.get(function, ()))
+
+    def frame(self, function):
+        if function == self.handle_key_event:
+            return self.args.controller_stack
+        size, name = frame_size(function, self.frames)
+        if size is None:
+            return 0
+        if name in self.dynamic:
+            self.errors.append('%s has a dynamic stack frame' % function)
+        return size
+
+    # The worst-case stack depth below `function` (including its own frame), and the path.
+    # `nested` is set below a call to `handleKeyEvent()`.
+    def depth(self, function, path, nested=False):
+        reentry = function == self.on_key_event and path and path[-1] == self.handle_key_event
+        if function in path and not reentry:
+            self.errors.append('recursion: ' + ' -> '.join(path + [function]))
+            return 0, []
+        nested = nested or function == self.handle_key_event
+        path = path + [function]
+        worst, worst_path = 0, []
+        for callee in self.callees(function, nested):
+            depth, callee_path = self.depth(callee, path, nested)
+            depth += self.args.call_cost
+            if depth > worst:
+                worst, worst_path = depth, callee_path
+        return self.frame(function) + worst, [function] + worst_path
+
+
+# The margins over the measured numbers, for `--write-budgets`: a percentage of .text
+# (rounded up to a multiple of 16 bytes), and a fixed number of bytes for the others
+TEXT_MARGIN_PERCENT = 2
+DATA_MARGIN = 8
+BSS_MARGIN = 8
+STACK_MARGIN = 16
+
+
+def read_budgets(path, variant):
+    toolchain, budgets = None, None
+    with open(path) as lines:
+        for line in lines:
+            fields = line.split('#', 1)[0].split()
+            if not fields:
+                continue
+            if fields[0] == 'toolchain':
+                toolchain = ' '.join(fields[1:])
+            elif fields[0] == variant:
+                budgets = [int(field) for field in fields[1:5]]
+    return toolchain, budgets
+
+
+def write_budgets(records, toolchain):
+    print('# Footprint budgets (bytes) for `make footprint`, one line per variant:')
+    print('#')
+    print('#   variant     .text   .data   .bss    stack')
+    print('#')
+    print('# Written by `make budgets`, from the numbers measured with the toolchain below, plus')
+    print('# a small margin (see `footprint.py`). `make footprint` refuses to check against')
+    print('# them with any other compiler.')
+    print()
+    print('toolchain ' + toolchain)
+    print()
+    for path in records:
+        with open(path) as record:
+            for line in record:
+                variant, text, data, bss, stack = line.split()
+                text = int(text) * (100 + TEXT_MARGIN_PERCENT) // 100
+                text = (text + 15) // 16 * 16
+                print('%-12s %8d %7d %7d %7d' % (variant, text, int(data) + DATA_MARGIN,
+                                                 int(bss) + BSS_MARGIN,
+                                                 int(stack) + STACK_MARGIN))
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--variant')
+    parser.add_argument('--budgets')
+    parser.add_argument('--toolchain',
+                        help='the compiler version, which must match the budgets file')
+    parser.add_argument('--record', help='file to append the measured numbers to')
+    parser.add_argument('--write-budgets', action='store_true',
+                        help='print a budgets file from the recorded numbers (the arguments)')
+    parser.add_argument('--size', default='avr-size')
+    parser.add_argument('--objdump', default='avr-objdump')
+    parser.add_argument('--cxxfilt', default='avr-c++filt')
+    parser.add_argument('--call-cost', type=int, default=2,
+                        help='bytes pushed by each call (the return address)')
+    parser.add_argument('--controller-stack', type=int, default=32,
+                        help='stack used by Controller::handleKeyEvent() itself')
+    parser.add_argument('--entry', action='append', default=[],
+                        help='entry point to report (matched against function names)')
+    parser.add_argument('--verbose', action='store_true')
+    parser.add_argument('objects', nargs='+')
+    args = parser.parse_args()
+
+    if args.write_budgets:
+        write_budgets(args.objects, args.toolchain)
+        return 0
+    if args.variant is None:
+        parser.error('--variant is required')
+
+    objects = args.objects
+    su_files = [re.sub(r'\.o$', '.su', path) for path in objects]
+
+    text, data, bss = read_sizes(args.size, objects)
+    frames, dynamic = read_frames(su_files)
+    calls = read_calls(args.objdump, args.cxxfilt, objects)
+    analysis = Analysis(frames, dynamic, calls, args)
+
+    stack = 0
+    paths = []
+    for entry in args.entry:
+        matches = [f for f in calls if entry + '(' in f]
+        if not matches:
+            analysis.errors.append('entry point %s not found' % entry)
+        for function in matches:
+            depth, path = analysis.depth(function, [])
+            paths.append((function, depth, path))
+            stack = max(stack, depth)
+
+    print('%-12s %8d %8d %8d %8d' % (args.variant, text, data, bss, stack))
+    if args.record:
+        with open(args.record, 'a') as record:
+            record.write('%s %d %d %d %d\n' % (args.variant, text, data, bss, stack))
+    for function, depth, path in paths:
+        if args.verbose:
+            print('  %5d  %s' % (depth, ' -> '.join(path).replace('kaleidoglyph::', '')))
+
+    failed = False
+    for error in analysis.errors:
+        print('  error: ' + error)
+        failed = True
+    if args.budgets:
+        toolchain, budgets = read_budgets(args.budgets, args.variant)
+        if toolchain != args.toolchain:
+            print('  error: the budgets were measured with %s, not %s (run `make budgets`)' %
+                  (toolchain or 'no toolchain', args.toolchain))
+            failed = True
+        elif budgets is None:
+            print('  error: no budget for %s (run `make budgets`)' % args.variant)
+            failed = True
+        else:
+            for name, value, budget in zip(('.text', '.data', '.bss', 'stack'),
+                                           (text, data, bss, stack), budgets):
+                if value > budget:
+                    print('  over budget: %s is %d bytes (budget %d)' % (name, value, budget))
+                    failed = True
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
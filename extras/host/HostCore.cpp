@@ -0,0 +1,264 @@
+// -*- c++ -*-
+
+#include "HostCore.h"
+
+#include <Arduino.h>
+#include <avr/eeprom.h>
+
+#include <kaleidoglyph/Controller.h>
+#include <kaleidoglyph/Key.h>
+#include <kaleidoglyph/KeyAddr.h>
+#include <kaleidoglyph/KeyEvent.h>
+#include <kaleidoglyph/cKey.h>
+#include <kaleidoglyph/hooks.h>
+
+#if ! defined(__AVR__)
+#include <chrono>
+#endif
+#include <stdio.h>
+#include <string.h>
+
+
+namespace kaleidoglyph {
+namespace host {
+
+Key keymap[layer_count][total_keys];
+Stats stats;
+#if ! defined(__AVR__)
+byte eeprom[eeprom_size];
+long eeprom_writes_left{-1};
+#endif
+
+namespace {
+
+EventHandlerFunction event_handler{nullptr};
+uint32_t current_time{0};
+
+Key    active_keys[total_keys];
+// The number of active layer-shift keys for each layer
+byte   layer_shift_counts[layer_count];
+Report last_report;
+
+Key lookup(KeyAddr k) {
+  for (byte layer = layer_count; layer-- > 0; ) {
+    if ((layerState() & (uint32_t(1) << layer)) && keymap[layer][k.addr()] != cKey::clear) {
+      return keymap[layer][k.addr()];
+    }
+  }
+  return cKey::clear;
+}
+
+void updateLayerState(Key key, bool pressed) {
+  if (! LayerKey::verifyType(key)) return;
+  byte layer = LayerKey(key).index();
+  if (layer >= layer_count) return;
+  if (pressed) {
+    ++layer_shift_counts[layer];
+  } else if (layer_shift_counts[layer] != 0) {
+    --layer_shift_counts[layer];
+  }
+}
+
+void sendReport() {
+  Report report{};
+  for (byte k = 0; k < total_keys; ++k) {
+    const Key key = active_keys[k];
+    if (! KeyboardKey::verifyType(key)) continue;
+    KeyboardKey keyboard_key{key};
+    bitSet(report.keycodes[keyboard_key.keycode() >> 5], keyboard_key.keycode() & 31);
+    for (byte m = 0; m < 8; ++m) {
+      if (bitRead(keyboard_key.mods(), m)) {
+        byte keycode = KeyboardKey::mod_keycode_offset + m;
+        bitSet(report.keycodes[keycode >> 5], keycode & 31);
+      }
+    }
+  }
+  last_report = report;
+  ++stats.reports;
+}
+
+class StdoutPrint : public Print {
+ public:
+  size_t write(uint8_t c) override {
+    putchar(c);
+    return 1;
+  }
+};
+StdoutPrint stdout_print;
+
+} // namespace {
+
+Print& out{stdout_print};
+
+void setEventHandler(EventHandlerFunction handler) {
+  event_handler = handler;
+}
+
+uint32_t time() {
+  return current_time;
+}
+void setTime(uint32_t ms) {
+  current_time = ms;
+}
+void advanceTime(uint32_t ms) {
+  current_time += ms;
+}
+
+void press(KeyAddr k) {
+  KeyEvent event{k, cKeyState::press};
+  Controller().handleKeyEvent(event);
+}
+void release(KeyAddr k) {
+  KeyEvent event{k, cKeyState::release};
+  Controller().handleKeyEvent(event);
+}
+
+bool Report::operator==(const Report& other) const {
+  return memcmp(keycodes, other.keycodes, sizeof(keycodes)) == 0;
+}
+const Report& report() {
+  return last_report;
+}
+
+uint32_t layerState() {
+  uint32_t state{1};
+  for (byte layer = 1; layer < layer_count; ++layer) {
+    if (layer_shift_counts[layer] != 0) {
+      state |= uint32_t(1) << layer;
+    }
+  }
+  return state;
+}
+
+void reset() {
+  for (byte k = 0; k < total_keys; ++k) {
+    active_keys[k] = cKey::clear;
+  }
+  memset(layer_shift_counts, 0, sizeof(layer_shift_counts));
+  last_report = Report{};
+  stats = Stats{};
+  current_time = 0;
+}
+
+} // namespace host {
+
+
+uint32_t Controller::scanStartTime() {
+  return host::current_time;
+}
+
+void Controller::handleKeyEvent(KeyEvent& event) {
+  using namespace host;
+
+  if (event.state.isInjected()) {
+    if (event.state.toggledOn()) {
+      ++stats.injected_presses;
+    } else {
+      ++stats.injected_releases;
+    }
+  } else {
+    ++stats.key_events;
+  }
+
+  if (event.key == cKey::clear) {
+    event.key = event.state.toggledOn() ? lookup(event.addr) : active_keys[event.addr.addr()];
+  }
+
+  if (event_handler != nullptr && event_handler(event) == EventHandlerResult::abort) {
+    return;
+  }
+
+  Key& active_key = active_keys[event.addr.addr()];
+  if (event.state.toggledOn()) {
+    updateLayerState(active_key, false);
+    active_key = event.key;
+    updateLayerState(active_key, true);
+  } else if (event.state.toggledOff()) {
+    updateLayerState(active_key, false);
+    active_key = cKey::clear;
+  }
+  sendReport();
+}
+
+Key& Controller::operator[](KeyAddr k) {
+  return host::active_keys[k.addr()];
+}
+
+
+namespace hooks {
+void setLedForeground(KeyAddr) {
+  ++host::stats.led_updates;
+}
+} // namespace hooks {
+
+} // namespace kaleidoglyph {
+
+
+unsigned long millis() {
+  return kaleidoglyph::host::time();
+}
+// On the AVR (the simavr bench in `extras/avr`), the bench provides `micros()`, and the
+// EEPROM functions are avr-libc's own
+#if ! defined(__AVR__)
+unsigned long micros() {
+  using namespace std::chrono;
+  return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+
+size_t Print::print(const char* s) {
+  size_t n{0};
+  while (*s) {
+    n += write(*s++);
+  }
+  return n;
+}
+size_t Print::print(const __FlashStringHelper* s) {
+  const char* p = reinterpret_cast<const char*>(s);
+  size_t n{0};
+  for (char c; (c = pgm_read_byte(p)) != '\0'; ++p) {
+    n += write(c);
+  }
+  return n;
+}
+size_t Print::print(unsigned long number, int base) {
+  char buffer[8 * sizeof(number) + 1];
+  snprintf(buffer, sizeof(buffer), base == HEX ? "%lX" : "%lu", number);
+  return print(buffer);
+}
+size_t Print::println(const char* s) {
+  return print(s) + write('\n');
+}
+size_t Print::println(const __FlashStringHelper* s) {
+  return print(s) + write('\n');
+}
+size_t Print::println(unsigned long number, int base) {
+  return print(number, base) + write('\n');
+}
+
+
+#if ! defined(__AVR__)
+uint8_t eeprom_read_byte(const uint8_t* addr) {
+  ++kaleidoglyph::host::stats.eeprom_reads;
+  return kaleidoglyph::host::eeprom[uintptr_t(addr)];
+}
+void eeprom_update_byte(uint8_t* addr, uint8_t value) {
+  using namespace kaleidoglyph::host;
+  byte& cell = eeprom[uintptr_t(addr)];
+  // Like the real thing, only bytes that change get written
+  if (cell == value || eeprom_writes_left == 0) return;
+  if (eeprom_writes_left > 0) --eeprom_writes_left;
+  cell = value;
+}
+void eeprom_read_block(void* dst, const void* addr, size_t n) {
+  ++kaleidoglyph::host::stats.eeprom_reads;
+  memcpy(dst, &kaleidoglyph::host::eeprom[uintptr_t(addr)], n);
+}
+void eeprom_update_block(const void* src, void* addr, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    uint8_t* dst = static_cast<uint8_t*>(addr) + i;
+    eeprom_update_byte(dst, static_cast<const uint8_t*>(src)[i]);
+  }
+}
+#endif
@@ -0,0 +1,87 @@
+// -*- c++ -*-
+
+// The host side of the stand-in Kaleidoglyph core (see `stubs/`). A host program sets up
+// a keymap, installs the plugin's event handler, and then drives it with key switch
+// events and a simulated clock, the same way the real `Controller` would.
+
+#pragma once
+
+#include <Arduino.h>
+
+#include <kaleidoglyph/Controller.h>
+#include <kaleidoglyph/EventHandlerResult.h>
+#include <kaleidoglyph/Key.h>
+#include <kaleidoglyph/KeyAddr.h>
+#include <kaleidoglyph/KeyEvent.h>
+
+namespace kaleidoglyph {
+namespace host {
+
+constexpr byte layer_count{4};
+
+// The keymap. A `cKey::clear` entry falls through to the next active layer below it.
+extern Key keymap[layer_count][total_keys];
+
+// The plugin chain: called for every event, injected or not. If it returns `abort`, the
+// event has no effect on the active keys or the report.
+typedef EventHandlerResult (*EventHandlerFunction)(KeyEvent& event);
+void setEventHandler(EventHandlerFunction handler);
+
+// The simulated clock, returned by `Controller::scanStartTime()` (and `millis()`)
+uint32_t time();
+void setTime(uint32_t ms);
+void advanceTime(uint32_t ms);
+
+// Send a key switch event through the controller, as the matrix scan would
+void press(KeyAddr k);
+void release(KeyAddr k);
+
+// The HID keyboard report: one bit per keycode, with modifier flags included as their
+// keycodes (0xE0-0xE7)
+struct Report {
+  uint32_t keycodes[8];
+
+  bool isPressed(byte keycode) const {
+    return bitRead(keycodes[keycode >> 5], keycode & 31);
+  }
+  bool operator==(const Report& other) const;
+  bool operator!=(const Report& other) const {
+    return ! (*this == other);
+  }
+};
+// The last report sent
+const Report& report();
+
+// Bit `n` is set if layer `n` is active (layer 0 always is)
+uint32_t layerState();
+
+// Counts of what the controller has done since the last `reset()`
+struct Stats {
+  uint32_t key_events;
+  uint32_t injected_presses;
+  uint32_t injected_releases;
+  uint32_t reports;
+  uint32_t led_updates;
+  uint32_t eeprom_reads;  // calls to the EEPROM read functions
+};
+extern Stats stats;
+
+// The EEPROM, for `avr/eeprom.h` (except on the AVR, which has a real one)
+#if ! defined(__AVR__)
+constexpr uint16_t eeprom_size{1024};
+extern byte eeprom[eeprom_size];
+
+// The number of EEPROM bytes that can still be changed before a simulated power loss, after
+// which further writes are ignored. Negative (the default) means no limit.
+extern long eeprom_writes_left;
+#endif
+
+// Release everything, deactivate all layers, clear the stats, and set the clock to zero.
+// The keymap, event handler & EEPROM are left as they are.
+void reset();
+
+// A `Print` that writes to stdout
+extern Print& out;
+
+} // namespace host {
+} // namespace kaleidoglyph {
@@ -0,0 +1,213 @@
+// -*- c++ -*-
+
+// Tests for the adaptive timeout (`KALEIDOGLYPH_GLUKEYS_ADAPTIVE_TIMEOUT`). The estimator
+// (`AdaptiveTimeout`) is fed known glukey-to-trigger intervals, and its timeout is checked
+// against a floating-point version of the same running mean & mean deviation, and against
+// the limits & the warm-up. Then the plugin is driven with the same kind of intervals
+// through key events, to check that it takes its samples & uses the timeout.
+//
+// Usage: adaptive
+
+#include <Arduino.h>
+
+#include <kaleidoglyph/Controller.h>
+#include <kaleidoglyph/Key.h>
+#include <kaleidoglyph/KeyAddr.h>
+
+#include "glukeys/Glukeys.h"
+#include "HostCore.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace kaleidoglyph;
+using glukeys::AdaptiveTimeout;
+using glukeys::adaptive_timeout_max;
+using glukeys::adaptive_timeout_min;
+using glukeys::adaptive_timeout_warmup;
+
+namespace {
+
+unsigned failures{0};
+
+void check(bool ok, const char* what, long actual, long expected) {
+  if (! ok) {
+    fprintf(stderr, "adaptive: %s: got %ld, expected %ld\n", what, actual, expected);
+    ++failures;
+  }
+}
+
+// The same estimate, in floating point: mean += (x - mean) / 8, and
+// deviation += (|x - mean| - deviation) / 4, starting from the first sample (with a
+// deviation of half of it)
+struct Reference {
+  double mean{0};
+  double deviation{0};
+  unsigned count{0};
+
+  void addSample(double x) {
+    if (x > adaptive_timeout_max) x = adaptive_timeout_max;
+    if (count++ == 0) {
+      mean = x;
+      deviation = x / 2;
+    }
+    double error = x - mean;
+    mean += error / 8;
+    deviation += (fabs(error) - deviation) / 4;
+  }
+  double timeout() const {
+    return fmin(fmax(mean + 4 * deviation, adaptive_timeout_min), adaptive_timeout_max);
+  }
+};
+
+// Feed `count` samples, cycling through `intervals`, to both, and check the timeout
+// against the reference after every sample past the warm-up. The fixed-point version
+// rounds its terms, so it can be a few ms off the reference, but not more.
+void checkIntervals(const char* name, const uint16_t* intervals, byte interval_count,
+                    unsigned count, uint16_t expected) {
+  AdaptiveTimeout estimate;
+  Reference reference;
+  for (unsigned n = 0; n < count; ++n) {
+    uint16_t x = intervals[n % interval_count];
+    estimate.addSample(x);
+    reference.addSample(x);
+    if (n + 1 < adaptive_timeout_warmup) continue;
+    if (labs(long(reference.timeout()) - long(estimate.timeout())) > 16) {
+      check(false, name, estimate.timeout(), long(reference.timeout()));
+      return;
+    }
+  }
+  if (expected != 0) {
+    check(labs(long(estimate.timeout()) - long(expected)) <= 16, name,
+          estimate.timeout(), expected);
+  }
+}
+
+void checkEstimator() {
+  // Steady intervals: the deviation decays to nothing, so the timeout is just the mean,
+  // unless that's under the minimum
+  const uint16_t steady[] = {3000};
+  checkIntervals("steady 3000 ms", steady, 1, 200, 3000);
+  const uint16_t fast[] = {200};
+  checkIntervals("steady 200 ms (minimum)", fast, 1, 200, adaptive_timeout_min);
+  const uint16_t slow[] = {20000};
+  checkIntervals("steady 20000 ms (maximum)", slow, 1, 200, adaptive_timeout_max);
+
+  // Alternating intervals: mean 1000, mean deviation settles near 400 (the error is
+  // measured from a mean that lags the latest sample), so the timeout is mean + 4 * 400
+  const uint16_t alternating[] = {600, 1400};
+  Reference reference;
+  for (unsigned n = 0; n < 400; ++n) reference.addSample(alternating[n % 2]);
+  checkIntervals("alternating 600/1400 ms", alternating, 2, 400,
+                 uint16_t(reference.timeout()));
+  check(fabs(reference.mean - 1000) < 50, "alternating mean", long(reference.mean), 1000);
+  check(reference.timeout() > 2400 && reference.timeout() < 2800,
+        "alternating mean + 4 * deviation", long(reference.timeout()), 2600);
+
+  // Irregular intervals, checked after every sample
+  const uint16_t irregular[] = {350, 900, 410, 2600, 180, 760, 1200, 95, 5200, 640, 300};
+  checkIntervals("irregular", irregular, sizeof(irregular) / sizeof(irregular[0]), 500, 0);
+
+  // Before the warm-up is over, the timeout stays at the default, however short or long
+  // the intervals are. The first sample sets the mean (and half of it as the deviation),
+  // so the first timeout after the warm-up already reflects the samples.
+  const uint16_t warmup_intervals[] = {300, 7000};
+  for (uint16_t x : warmup_intervals) {
+    AdaptiveTimeout estimate;
+    Reference reference;
+    check(estimate.timeout() == 2000, "no samples", estimate.timeout(), 2000);
+    for (byte n = 1; n < adaptive_timeout_warmup; ++n) {
+      estimate.addSample(x);
+      reference.addSample(x);
+      check(estimate.timeout() == 2000, "during the warm-up", estimate.timeout(), 2000);
+    }
+    estimate.addSample(x);
+    reference.addSample(x);
+    check(labs(long(estimate.timeout()) - long(reference.timeout())) <= 16,
+          "after the warm-up", estimate.timeout(), long(reference.timeout()));
+  }
+}
+
+// Key 0 is a modifier glukey, and key 1 is a letter, for the trigger
+const Key glukey_table[] = {KeyboardKey(0x04)};
+
+Controller controller;
+glukeys::Plugin glukeys_plugin{glukey_table, controller};
+
+EventHandlerResult onKeyEvent(KeyEvent& event) {
+  return glukeys_plugin.onKeyEvent(event);
+}
+
+constexpr byte glukey_addr{0};
+constexpr byte letter_addr{1};
+
+void wait(uint16_t ms) {
+  for (; ms >= 5; ms -= 5) {
+    host::advanceTime(5);
+    glukeys_plugin.preKeyswitchScan();
+  }
+  host::advanceTime(ms);
+  glukeys_plugin.preKeyswitchScan();
+}
+
+// Tap the glukey, and then tap the trigger `interval` ms after the glukey was pressed
+void tapThenTrigger(uint16_t interval) {
+  host::press(KeyAddr{glukey_addr});
+  wait(20);
+  host::release(KeyAddr{glukey_addr});
+  wait(interval - 20);
+  host::press(KeyAddr{letter_addr});
+  wait(20);
+  host::release(KeyAddr{letter_addr});
+  wait(200);
+}
+
+// The timeout the plugin gave a glukey that was just tapped, from its deadline, which is
+// rounded up to the next 64 ms tick
+long tappedTimeout() {
+  host::press(KeyAddr{glukey_addr});
+  host::release(KeyAddr{glukey_addr});
+  // Send its LED update, which would otherwise make the deadline 0
+  glukeys_plugin.preKeyswitchScan();
+  return glukeys_plugin.timeUntilDeadline();
+}
+
+void checkPlugin() {
+  host::keymap[0][glukey_addr] = glukeys::glukeysModifierKey(0);
+  host::keymap[0][letter_addr] = KeyboardKey(0x05);
+  host::setEventHandler(onKeyEvent);
+  host::reset();
+  glukeys_plugin.setAdaptiveTimeout();
+
+  AdaptiveTimeout expected;
+  for (byte n = 0; n < 30; ++n) {
+    tapThenTrigger(400);
+    expected.addSample(400);
+  }
+  long timeout = tappedTimeout();
+  check(timeout >= expected.timeout() && timeout < expected.timeout() + 64,
+        "plugin timeout after 400 ms intervals", timeout, expected.timeout());
+
+  // Let that glukey time out; that counts as a sample of the current timeout
+  wait(expected.timeout() + 64);
+  expected.addSample(expected.timeout());
+  check(glukeys_plugin.state(KeyAddr{glukey_addr}) == glukeys::State::clear,
+        "plugin glukey timed out", long(glukeys_plugin.state(KeyAddr{glukey_addr})), 0);
+  timeout = tappedTimeout();
+  check(timeout >= expected.timeout() && timeout < expected.timeout() + 64,
+        "plugin timeout after a timeout", timeout, expected.timeout());
+}
+
+} // namespace {
+
+int main() {
+  checkEstimator();
+  checkPlugin();
+  if (failures != 0) {
+    fprintf(stderr, "adaptive: %u failures\n", failures);
+    return 1;
+  }
+  printf("adaptive: all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,146 @@
+// -*- c++ -*-
+
+// Microbenchmarks for `glukeys::Plugin`, run on the host against the stand-in core. Each
+// stream is a repeated sequence of key switch events, with a scan (`preKeyswitchScan()`
+// and 5 ms of simulated time) before each one, so the times include everything the
+// plugin does per event. The stand-in controller's own work is included, too, but it's
+// small compared to the plugin's.
+//
+// Usage: bench [repetitions]
+
+#include <Arduino.h>
+
+#include <kaleidoglyph/Controller.h>
+#include <kaleidoglyph/Key.h>
+#include <kaleidoglyph/KeyAddr.h>
+
+#include "glukeys/Glukeys.h"
+#include "HostCore.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace kaleidoglyph;
+
+namespace {
+
+const Key glukey_table[] = {
+  KeyboardKey(0x2A),
+};
+
+Controller controller;
+glukeys::Plugin glukeys_plugin{glukey_table, controller};
+
+EventHandlerResult onKeyEvent(KeyEvent& event) {
+  return glukeys_plugin.onKeyEvent(event);
+}
+
+// Layer 0: letters at 0-25, modifier glukeys at 32-39, a layer-shift glukey at 40
+constexpr byte letter_addr{0};
+constexpr byte modifier_glukey_addr{32};
+constexpr byte layer_glukey_addr{40};
+
+void setupKeymap() {
+  for (byte i = 0; i < 26; ++i) {
+    host::keymap[0][letter_addr + i] = KeyboardKey(byte(0x04 + i));
+    host::keymap[1][letter_addr + i] = KeyboardKey(byte(0x1E + i % 10));
+  }
+  for (byte i = 0; i < 8; ++i) {
+    host::keymap[0][modifier_glukey_addr + i] = glukeys::glukeysModifierKey(i);
+  }
+  host::keymap[0][layer_glukey_addr] = glukeys::glukeysLayerShiftKey(1);
+}
+
+void scan() {
+  host::advanceTime(5);
+  glukeys_plugin.preKeyswitchScan();
+}
+void tap(byte k) {
+  scan();
+  host::press(KeyAddr{k});
+  scan();
+  host::release(KeyAddr{k});
+}
+
+// Plain typing, with no glukeys active
+void plainTyping() {
+  for (byte i = 0; i < 26; ++i) {
+    tap(letter_addr + i);
+  }
+}
+
+// A modifier glukey held while another key is tapped, so it never becomes `sticky`
+void chordedModifiers() {
+  for (byte i = 0; i < 8; ++i) {
+    scan();
+    host::press(KeyAddr{byte(modifier_glukey_addr + i)});
+    tap(letter_addr + i);
+    scan();
+    host::release(KeyAddr{byte(modifier_glukey_addr + i)});
+  }
+}
+
+// One glukey tapped three times: `sticky`, `locked`, then `clear`
+void stickyLockedClear() {
+  for (byte i = 0; i < 8; ++i) {
+    tap(modifier_glukey_addr + i);
+    tap(modifier_glukey_addr + i);
+    tap(modifier_glukey_addr + i);
+  }
+}
+
+// Eight `sticky` modifiers and a `sticky` layer shift, all released by one trigger key
+void massRelease() {
+  for (byte i = 0; i < 8; ++i) {
+    tap(modifier_glukey_addr + i);
+  }
+  tap(layer_glukey_addr);
+  tap(letter_addr);
+}
+
+struct Stream {
+  const char* name;
+  void (*run)();
+};
+
+const Stream streams[] = {
+  {"plain typing",          plainTyping},
+  {"chorded modifiers",     chordedModifiers},
+  {"sticky-locked-clear",   stickyLockedClear},
+  {"mass release",          massRelease},
+};
+
+} // namespace {
+
+
+int main(int argc, char* argv[]) {
+  unsigned long repetitions = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 100000;
+
+  setupKeymap();
+  host::setEventHandler(onKeyEvent);
+
+  printf("%-22s %10s %10s %12s %10s %10s\n",
+         "stream", "events", "ns/event", "events/sec", "injected", "reports");
+  for (const Stream& stream : streams) {
+    host::reset();
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned long r = 0; r < repetitions; ++r) {
+      stream.run();
+    }
+    scan();
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    double events = host::stats.key_events;
+    printf("%-22s %10.0f %10.1f %12.0f %10lu %10lu\n",
+           stream.name, events, ns / events, events * 1e9 / ns,
+           (unsigned long)(host::stats.injected_presses + host::stats.injected_releases),
+           (unsigned long)host::stats.reports);
+    // Every stream leaves the plugin idle, so they don't affect each other
+    if (host::report() != host::Report{} || host::layerState() != 1) {
+      printf("  stream left keys or layers active\n");
+      return 1;
+    }
+  }
+  return 0;
+}
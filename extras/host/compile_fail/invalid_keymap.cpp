@@ -0,0 +1,57 @@
+// -*- c++ -*-
+
+// A keymap with a GlukeysKey past the end of the glukeys table: with
+// `KALEIDOGLYPH_GLUKEYS_VALIDATED_KEYMAP`, the plugin can't be given that table.
+//
+// Flags: -DKALEIDOGLYPH_GLUKEYS_VALIDATED_KEYMAP
+// Error: Keymap has GlukeysKey entries beyond the end of the glukeys table
+
+#include <Arduino.h>
+
+#include <kaleidoglyph/Controller.h>
+#include <kaleidoglyph/Key.h>
+
+#include "glukeys/Glukeys.h"
+
+using namespace kaleidoglyph;
+using glukeys::GlukeysKey;
+
+constexpr Key glukey_table[] = {KeyboardKey(0x04), KeyboardKey(0x05)};
+
+#if defined(COMPILE_FAIL_FIXED)
+constexpr Key last_glukey = GlukeysKey{1};
+#else
+constexpr Key last_glukey = GlukeysKey{2};
+#endif
+
+constexpr Key no_key{};
+
+constexpr Key keymap[2][total_keys] = {
+  {
+    GlukeysKey{0}, KeyboardKey(0x06), no_key, no_key,
+    no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+  },
+  {
+    no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, last_glukey,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+  },
+};
+static_assert(total_keys == 64, "the keymap assumes 64 keys");
+
+Controller controller;
+glukeys::Plugin glukeys_plugin{glukeys::ValidatedKeymap<keymap, glukey_table>{},
+                               controller};
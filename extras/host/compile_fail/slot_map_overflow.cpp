@@ -0,0 +1,42 @@
+// -*- c++ -*-
+
+// A keymap with GlukeysKeys at three addresses, for two state slots: `makeSlotMap()` must
+// refuse it, rather than leave one of them without a slot. (Fixed, the third one isn't a
+// GlukeysKey.)
+//
+// Flags: -DKALEIDOGLYPH_GLUKEYS_STATE_SLOTS=2
+// Error: Not enough glukeys state slots
+
+#include <Arduino.h>
+
+#include <kaleidoglyph/Key.h>
+
+#include "glukeys/Glukeys.h"
+
+using namespace kaleidoglyph;
+
+#if defined(COMPILE_FAIL_FIXED)
+constexpr Key third_key = KeyboardKey(0x05);
+#else
+constexpr Key third_key = glukeys::GlukeysKey{2};
+#endif
+
+constexpr Key no_key{};
+
+constexpr Key keymap[1][total_keys] = {
+  {
+    glukeys::GlukeysKey{0}, KeyboardKey(0x04), glukeys::GlukeysKey{1}, third_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key,
+  },
+};
+static_assert(total_keys == 64, "the keymap assumes 64 keys");
+
+const PROGMEM glukeys::StateSlotMap glukeys::state_slot_map =
+    glukeys::makeSlotMap<glukeys::state_slot_count, keymap>();
@@ -0,0 +1,43 @@
+// -*- c++ -*-
+
+// With `KALEIDOGLYPH_GLUKEYS_VALIDATED_KEYMAP`, the plugin can only be given its table
+// through a `ValidatedKeymap`, not on its own.
+//
+// Flags: -DKALEIDOGLYPH_GLUKEYS_VALIDATED_KEYMAP
+// Error: private within this context
+
+#include <Arduino.h>
+
+#include <kaleidoglyph/Controller.h>
+#include <kaleidoglyph/Key.h>
+
+#include "glukeys/Glukeys.h"
+
+using namespace kaleidoglyph;
+
+constexpr Key glukey_table[] = {KeyboardKey(0x04), KeyboardKey(0x05)};
+
+Controller controller;
+#if defined(COMPILE_FAIL_FIXED)
+constexpr Key no_key{};
+
+constexpr Key keymap[1][total_keys] = {
+  {
+    glukeys::GlukeysKey{0}, glukeys::GlukeysKey{1}, no_key, no_key,
+    no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+  },
+};
+static_assert(total_keys == 64, "the keymap assumes 64 keys");
+
+glukeys::Plugin glukeys_plugin{glukeys::ValidatedKeymap<keymap, glukey_table>{},
+                               controller};
+#else
+glukeys::Plugin glukeys_plugin{glukey_table, controller};
+#endif
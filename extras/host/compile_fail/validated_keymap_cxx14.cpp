@@ -0,0 +1,15 @@
+// -*- c++ -*-
+
+// `KALEIDOGLYPH_GLUKEYS_VALIDATED_KEYMAP` needs C++17, and says so, rather than failing
+// with errors about `auto` template parameters. Without it, C++14 is enough.
+//
+// Flags: -std=gnu++14
+// Error: KALEIDOGLYPH_GLUKEYS_VALIDATED_KEYMAP needs C++17
+
+#if ! defined(COMPILE_FAIL_FIXED)
+#define KALEIDOGLYPH_GLUKEYS_VALIDATED_KEYMAP
+#endif
+
+#include <Arduino.h>
+
+#include "glukeys/Glukeys.h"
@@ -0,0 +1,252 @@
+// -*- c++ -*-
+
+// Tests for the glukeys table in EEPROM (`KALEIDOGLYPH_GLUKEYS_WITH_EEPROM`):
+//
+//   - a table with a bad magic byte, version or count is ignored, and so is one whose
+//     `format()` was cut short (at every possible point) by a simulated power loss
+//   - an index at or past the table's `count()` is rejected, both by `setEepromGlukey()`
+//     and when a GlukeysKey with that index is pressed
+//   - the SRAM cache: repeated lookups don't read the EEPROM, and a lookup never returns
+//     a stale entry after `update()`, `format()` or `begin()`
+//
+// Usage: eeprom
+
+#include <Arduino.h>
+
+#include <kaleidoglyph/Controller.h>
+#include <kaleidoglyph/Key.h>
+#include <kaleidoglyph/KeyAddr.h>
+#include <kaleidoglyph/cKey.h>
+
+#include "glukeys/Glukeys.h"
+#include "HostCore.h"
+
+#include <stdio.h>
+#include <string.h>
+
+using namespace kaleidoglyph;
+using glukeys::EepromTable;
+
+namespace {
+
+unsigned failures{0};
+
+void check(bool ok, const char* what) {
+  if (! ok) {
+    fprintf(stderr, "eeprom: %s\n", what);
+    ++failures;
+  }
+}
+
+constexpr byte table_count{6};
+
+// Two different tables, so it's clear which one a lookup came from
+const Key progmem_table[table_count] = {
+  KeyboardKey(0x04), KeyboardKey(0x05), KeyboardKey(0x06),
+  KeyboardKey(0x07), KeyboardKey(0x08), KeyboardKey(0x09),
+};
+const Key other_table[table_count] = {
+  KeyboardKey(0x14), KeyboardKey(0x15), KeyboardKey(0x16),
+  KeyboardKey(0x17), KeyboardKey(0x18), KeyboardKey(0x19),
+};
+
+constexpr uint16_t table_address{16};
+
+void eraseEeprom() {
+  memset(host::eeprom, 0xFF, sizeof(host::eeprom));
+  host::eeprom_writes_left = -1;
+}
+
+bool matches(const EepromTable& table, const Key* keys) {
+  if (table.count() != table_count) return false;
+  for (byte i = 0; i < table_count; ++i) {
+    if (table.lookup(i) != keys[i]) return false;
+  }
+  return true;
+}
+
+void checkHeader() {
+  EepromTable table;
+  eraseEeprom();
+  check(! table.begin(table_address), "erased EEPROM accepted as a table");
+  check(! table.isValid() && table.count() == 0, "erased EEPROM left a table in use");
+
+  table.format(table_address, progmem_table, table_count);
+  check(matches(table, progmem_table), "formatted table doesn't match");
+  EepromTable reread;
+  check(reread.begin(table_address) && matches(reread, progmem_table),
+        "formatted table can't be read back");
+
+  // Corrupt each header byte in turn. A table that was in use stops being used.
+  struct {
+    byte offset;
+    byte value;
+    const char* what;
+  } const corruptions[] = {
+    {0, glukeys::eeprom_table_magic ^ 1, "bad magic byte accepted"},
+    {1, glukeys::eeprom_table_version + 1, "wrong version accepted"},
+    {2, 0, "empty table accepted"},
+    {2, 0xFF, "count past the GlukeysKey range accepted"},
+  };
+  for (const auto& corruption : corruptions) {
+    table.format(table_address, progmem_table, table_count);
+    byte saved = host::eeprom[table_address + corruption.offset];
+    host::eeprom[table_address + corruption.offset] = corruption.value;
+    check(! table.begin(table_address) && ! table.isValid(), corruption.what);
+    host::eeprom[table_address + corruption.offset] = saved;
+  }
+}
+
+// Cut `format()` short after every possible number of bytes written, over an existing
+// table with different entries. `begin()` must then find either the old table, intact,
+// or the new one, complete; never a mix of the two.
+void checkTornWrites() {
+  EepromTable table;
+  eraseEeprom();
+  table.format(table_address, other_table, table_count);
+  byte old_image[host::eeprom_size];
+  memcpy(old_image, host::eeprom, sizeof(old_image));
+
+  unsigned old_count{0}, new_count{0}, invalid_count{0};
+  for (long limit = 0; ; ++limit) {
+    memcpy(host::eeprom, old_image, sizeof(old_image));
+    host::eeprom_writes_left = limit;
+    table.format(table_address, progmem_table, table_count);
+    bool complete = (host::eeprom_writes_left != 0);
+    host::eeprom_writes_left = -1;
+
+    EepromTable reread;
+    if (! reread.begin(table_address)) {
+      ++invalid_count;
+    } else if (matches(reread, other_table)) {
+      ++old_count;
+    } else if (matches(reread, progmem_table)) {
+      ++new_count;
+    } else {
+      fprintf(stderr, "eeprom: a format cut off after %ld bytes left a mixed table\n",
+              limit);
+      ++failures;
+    }
+    if (complete) break;
+  }
+  // Cut off before anything was written, the old table is intact; after that, the magic
+  // byte has been invalidated, and there's no table until the last byte (the magic) is
+  // written, which happens once with a limit, and once without reaching it.
+  check(old_count == 1, "a format cut off early didn't leave the old table");
+  check(invalid_count != 0, "no format was cut off in the middle");
+  check(new_count == 2, "a complete format didn't leave the new table");
+}
+
+// A GlukeysKey at address 0, for each table index (plus one past the end), and a plain
+// key to check the report with
+Controller controller;
+glukeys::Plugin glukeys_plugin{progmem_table, controller};
+
+EventHandlerResult onKeyEvent(KeyEvent& event) {
+  return glukeys_plugin.onKeyEvent(event);
+}
+
+// Tap the GlukeysKey for table entry `index` (while it's `pending`), and return the
+// keycode it added to the report, or 0 if none
+byte pressedKeycode(byte index) {
+  host::keymap[0][0] = glukeys::GlukeysKey{index};
+  host::press(KeyAddr{byte(0)});
+  byte keycode{0};
+  for (unsigned k = 1; k < 256; ++k) {
+    if (host::report().isPressed(byte(k))) keycode = byte(k);
+  }
+  host::release(KeyAddr{byte(0)});
+  // Clear it, so the next tap starts from `clear` again
+  glukeys_plugin.deactivate();
+  glukeys_plugin.activate();
+  glukeys_plugin.preKeyswitchScan();
+  return keycode;
+}
+
+void checkIndices() {
+  host::setEventHandler(onKeyEvent);
+  host::reset();
+  eraseEeprom();
+  glukeys_plugin.saveEepromTable(table_address);
+
+  check(glukeys_plugin.setEepromGlukey(table_count - 1, other_table[table_count - 1]),
+        "the last index was rejected");
+  check(! glukeys_plugin.setEepromGlukey(table_count, other_table[0]),
+        "an index equal to count() was accepted");
+  check(! glukeys_plugin.setEepromGlukey(0xFF, other_table[0]),
+        "index 0xFF was accepted");
+  check(pressedKeycode(table_count - 1) == KeyboardKey(other_table[table_count - 1]).keycode(),
+        "the last entry wasn't looked up from EEPROM");
+  check(pressedKeycode(table_count) == 0,
+        "a GlukeysKey past the end of the EEPROM table did something");
+
+  // A bigger EEPROM table than the PROGMEM one can use its extra entries, and a smaller
+  // one rejects entries that the PROGMEM table has
+  EepromTable table;
+  table.format(table_address, other_table, 2);
+  check(glukeys_plugin.useEepromTable(table_address), "a 2-entry table wasn't accepted");
+  check(pressedKeycode(1) == KeyboardKey(other_table[1]).keycode(),
+        "entry 1 of a 2-entry table wasn't looked up");
+  check(pressedKeycode(2) == 0, "entry 2 of a 2-entry table did something");
+
+  // Without a valid table, the PROGMEM one is used again
+  host::eeprom[table_address] = 0;
+  check(! glukeys_plugin.useEepromTable(table_address), "a bad table was accepted");
+  check(pressedKeycode(2) == KeyboardKey(progmem_table[2]).keycode(),
+        "the PROGMEM table isn't used after a bad EEPROM table");
+}
+
+void checkCache() {
+  EepromTable table;
+  eraseEeprom();
+  table.format(table_address, progmem_table, table_count);
+
+  // Repeated lookups come from the cache
+  table.lookup(1);
+  uint32_t reads = host::stats.eeprom_reads;
+  for (byte n = 0; n < 10; ++n) {
+    check(table.lookup(1) == progmem_table[1], "cached entry is wrong");
+  }
+  check(host::stats.eeprom_reads == reads, "repeated lookups read the EEPROM");
+
+  // `update()` writes through the cache
+  table.update(1, other_table[1]);
+  check(table.lookup(1) == other_table[1], "a lookup after update() returned the old entry");
+  EepromTable reread;
+  check(reread.begin(table_address) && reread.lookup(1) == other_table[1],
+        "update() didn't write the EEPROM");
+
+  // An update to an entry that shares a cache slot with a cached one (index 5 & 1, with
+  // 4 slots) doesn't change what the other one looks up
+  table.update(1 + glukeys::eeprom_cache_size, other_table[5]);
+  check(table.lookup(1) == other_table[1], "an update to another entry in the same slot "
+        "changed a lookup");
+  check(table.lookup(1 + glukeys::eeprom_cache_size) == other_table[5],
+        "an entry sharing a cache slot was looked up wrong");
+
+  // `format()` & `begin()` clear the cache, so entries that were cached from the old
+  // table (or changed behind its back) aren't returned
+  for (byte i = 0; i < table_count; ++i) table.lookup(i);
+  table.format(table_address, other_table, table_count);
+  check(matches(table, other_table), "a lookup after format() returned an old entry");
+  for (byte i = 0; i < table_count; ++i) table.lookup(i);
+  memcpy(&host::eeprom[table_address + glukeys::eeprom_table_header_size + 3 * sizeof(Key)],
+         &progmem_table[3], sizeof(Key));
+  check(table.begin(table_address) && table.lookup(3) == progmem_table[3],
+        "a lookup after begin() returned an old entry");
+}
+
+} // namespace {
+
+int main() {
+  checkHeader();
+  checkTornWrites();
+  checkIndices();
+  checkCache();
+  if (failures != 0) {
+    fprintf(stderr, "eeprom: %u failures\n", failures);
+    return 1;
+  }
+  printf("eeprom: all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,666 @@
+// -*- c++ -*-
+
+// A randomized differential tester for `glukeys::Plugin`. It feeds random sequences of key
+// presses & releases, scans (with the clock advancing), behaviour changes, and plugin
+// deactivation to the plugin, and the same sequences to a simple reference model of how
+// glukeys are supposed to behave, and checks that they agree: on the state of every key
+// after each event, and on the active keys & layers after each scan. The plugin is built
+// with `KALEIDOGLYPH_GLUKEYS_CHECK_INVARIANTS`, so it also checks its own internal
+// consistency (e.g. `temp_key_count_` against the bitfield) as it goes.
+//
+// The model keeps one state per key and applies the rules directly, with none of the
+// plugin's lists, queues, bitfields or timer wheel. It does share the key encoding
+// (`getKey()`), and it knows that timeouts are only checked once per 64 ms tick.
+//
+// Usage: fuzz [steps] [seed]
+
+#include <Arduino.h>
+
+#include <kaleidoglyph/Controller.h>
+#include <kaleidoglyph/Key.h>
+#include <kaleidoglyph/KeyAddr.h>
+#include <kaleidoglyph/cKey.h>
+
+#include "glukeys/Glukeys.h"
+#include "HostCore.h"
+
+#include <chrono>
+#include <new>
+#include <random>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace kaleidoglyph;
+using glukeys::Behaviour;
+using glukeys::GlukeysKey;
+using glukeys::State;
+
+namespace {
+
+// ----------------------------------------------------------------------------------------
+// Keymap
+
+// Only the first `key_count` addresses are used
+constexpr byte key_count{24};
+
+constexpr byte no_key{0xFF};
+
+const Key glukey_table[] = {
+  KeyboardKey(0x1B),
+  LayerKey(3),
+  modifierKey(3),
+};
+constexpr byte glukey_table_count = sizeof(glukey_table) / sizeof(glukey_table[0]);
+
+void setupKeymap() {
+  Key (&layer0)[total_keys] = host::keymap[0];
+  for (byte i = 0; i < 4; ++i) {
+    layer0[i] = KeyboardKey(byte(0x04 + i));
+  }
+  for (byte i = 0; i < 8; ++i) {
+    layer0[4 + i] = glukeys::glukeysModifierKey(i);
+  }
+  layer0[12] = modifierKey(1);
+  layer0[13] = glukeys::glukeysLayerShiftKey(1);
+  layer0[14] = glukeys::glukeysLayerShiftKey(2);
+  layer0[15] = LayerKey(1);
+  layer0[16] = GlukeysKey{0};
+  layer0[17] = GlukeysKey{1};
+  layer0[18] = GlukeysKey{5};  // past the end of the table
+  layer0[19] = glukeys::cGlukey::cancel;
+  layer0[20] = glukeys::cGlukey::meta;
+  layer0[21] = glukeys::glukeysModifiersKey(glukeys::cGlukeysModifier::control |
+                                            glukeys::cGlukeysModifier::alt);
+  layer0[22] = KeyboardKey(0x08);
+  layer0[23] = GlukeysKey{2};
+
+  host::keymap[1][0]  = KeyboardKey(0x1E);
+  host::keymap[1][1]  = KeyboardKey(0x1F);
+  host::keymap[1][2]  = GlukeysKey{0};
+  host::keymap[1][3]  = glukeys::cGlukey::cancel;
+  host::keymap[1][22] = LayerKey(2);
+
+  host::keymap[2][0]  = KeyboardKey(0x27);
+  host::keymap[2][1]  = glukeys::glukeysLayerShiftKey(3);
+  host::keymap[2][2]  = KeyboardKey(0x2C);
+
+  host::keymap[3][0]  = KeyboardKey(0x28);
+  host::keymap[3][1]  = KeyboardKey(0x29);
+}
+
+// ----------------------------------------------------------------------------------------
+// Reference model
+
+struct Config {
+  Behaviour behaviour;
+  bool      auto_modifiers;
+  bool      auto_layers;
+  uint16_t  temp_ttl;
+  uint16_t  modifier_ttl;
+  uint16_t  layer_ttl;
+  uint16_t  meta_ttl;
+};
+
+class Model {
+
+ public:
+  void begin(const Config& config) {
+    config_ = config;
+    for (byte k = 0; k < key_count; ++k) {
+      state_[k]     = State::clear;
+      active_[k]    = cKey::clear;
+      has_timer_[k] = false;
+    }
+    timer_count_   = 0;
+    trigger_       = no_key;
+    meta_          = no_key;
+    plugin_active_ = true;
+    last_tap_      = no_key;
+    last_tap_time_ = 0;
+  }
+
+  void setBehaviour(Behaviour behaviour) {
+    config_.behaviour = behaviour;
+  }
+  void deactivate() {
+    plugin_active_ = false;
+    releaseAll(true);
+  }
+  void activate() {
+    plugin_active_ = true;
+  }
+
+  void press(byte k) {
+    Key key = lookup(k);
+
+    if (! plugin_active_) {
+      if (glukeys::isGlukeysKey(key)) {
+        key = lookupGlukey(key);
+      }
+      active_[k] = key;
+      return;
+    }
+
+    // Rollover: a new press releases the glukeys waiting for the previous trigger
+    if (trigger_ != no_key) {
+      releaseAll(false);
+    }
+
+    switch (state_[k]) {
+      case State::pending :
+      case State::locked :
+        setState(k, State::clear);
+        return;
+      case State::sticky :
+        if (config_.behaviour == Behaviour::double_tap_lock &&
+            (last_tap_ != k || uint16_t(now() - last_tap_time_) >= glukeys::double_tap_window)) {
+          setState(k, State::clear);
+          active_[k] = cKey::clear;
+        } else {
+          setState(k, State::locked);
+        }
+        return;
+      case State::clear :
+        break;
+    }
+
+    if (key == glukeys::cGlukey::cancel) {
+#if defined(KALEIDOGLYPH_GLUKEYS_WITH_META)
+      if (meta_ != no_key) {
+        clearMeta();
+      }
+#endif
+      releaseAll(true);
+      return;
+    }
+
+#if defined(KALEIDOGLYPH_GLUKEYS_WITH_META)
+    if (key == glukeys::cGlukey::meta) {
+      if (meta_ != no_key) {
+        clearMeta();
+      }
+      meta_ = k;
+      active_[k] = key;
+      setPending(k, config_.meta_ttl);
+      return;
+    }
+    // While there's a meta-glukey, the next key becomes `locked`
+    if (meta_ != no_key) {
+      if (state_[meta_] == State::sticky) {
+        clearMeta();
+      } else if (state_[meta_] == State::pending) {
+        setState(meta_, State::clear);
+      }
+      if (glukeys::isGlukeysKey(key)) {
+        key = lookupGlukey(key);
+      }
+      active_[k] = key;
+      setState(k, State::locked);
+      return;
+    }
+#endif
+
+    const Key glukey = lookupGlukey(key);
+    if (glukey == cKey::clear) {
+      if (anyTemp() && isTrigger(key)) {
+        trigger_ = k;
+        // Sticky layer shifts only apply to the trigger key itself
+        for (byte j = 0; j < key_count; ++j) {
+          if (state_[j] == State::sticky && isLayerShiftKey(active_[j])) {
+            setState(j, State::clear);
+            active_[j] = cKey::clear;
+          }
+        }
+      }
+      active_[k] = key;
+      return;
+    }
+    if (glukey == cKey::blank) {
+      return;
+    }
+    active_[k] = glukey;
+    setPending(k, timeout(glukey));
+    last_tap_      = k;
+    last_tap_time_ = now();
+  }
+
+  void release(byte k) {
+    if (! plugin_active_) {
+      active_[k] = cKey::clear;
+      return;
+    }
+    switch (state_[k]) {
+      case State::clear :
+        if (k == trigger_) {
+          releaseAll(false);
+        }
+#if defined(KALEIDOGLYPH_GLUKEYS_WITH_META)
+        if (k == meta_) {
+          clearMeta();
+          return;
+        }
+#endif
+        active_[k] = cKey::clear;
+        return;
+      case State::pending :
+        setState(k, config_.behaviour == Behaviour::skip_sticky ? State::locked : State::sticky);
+        return;
+      case State::locked :
+      case State::sticky :
+        return;
+    }
+  }
+
+  // Time out the glukeys whose deadlines passed before the start of the current tick
+  void scan() {
+    for (byte k = 0; k < key_count; ++k) {
+      if (! has_timer_[k]) continue;
+      uint16_t due = ((deadline_[k] >> glukeys::timer_tick_bits) + 1) << glukeys::timer_tick_bits;
+      if (int16_t(now() - due) < 0) continue;
+#if defined(KALEIDOGLYPH_GLUKEYS_WITH_META)
+      if (k == meta_) {
+        clearMeta();
+        continue;
+      }
+#endif
+      if (state_[k] == State::sticky) {
+        active_[k] = cKey::clear;
+      }
+      setState(k, State::clear);
+    }
+    if (! anyTemp()) {
+      trigger_ = no_key;
+    }
+  }
+
+  State state(byte k) const {
+    return state_[k];
+  }
+  Key activeKey(byte k) const {
+    return active_[k];
+  }
+  uint32_t layerState() const {
+    uint32_t layers{1};
+    for (byte k = 0; k < key_count; ++k) {
+      if (LayerKey::verifyType(active_[k]) && LayerKey(active_[k]).index() < host::layer_count) {
+        layers |= uint32_t(1) << LayerKey(active_[k]).index();
+      }
+    }
+    return layers;
+  }
+  byte glukeyCount() const {
+    byte count{0};
+    for (byte k = 0; k < key_count; ++k) {
+      count += (state_[k] != State::clear);
+    }
+    return count;
+  }
+
+ private:
+  Config   config_;
+  State    state_[key_count];
+  Key      active_[key_count];
+  bool     has_timer_[key_count];
+  uint16_t deadline_[key_count];
+  byte     timer_count_;
+  byte     trigger_;
+  byte     meta_;
+  bool     plugin_active_;
+  byte     last_tap_;
+  uint16_t last_tap_time_;
+
+  static uint16_t now() {
+    return uint16_t(Controller::scanStartTime());
+  }
+
+  Key lookup(byte k) const {
+    uint32_t layers = layerState();
+    for (byte layer = host::layer_count; layer-- > 0; ) {
+      if ((layers >> layer) & 1 && host::keymap[layer][k] != cKey::clear) {
+        return host::keymap[layer][k];
+      }
+    }
+    return cKey::clear;
+  }
+
+  Key lookupGlukey(Key key) const {
+    if (glukeys::isGlukeysKey(key)) {
+      Key result = glukeys::getKey(GlukeysKey{key});
+      if (result == cKey::clear) {
+        byte index = GlukeysKey{key}.data();
+        result = (index < glukey_table_count) ? glukey_table[index] : cKey::blank;
+      }
+      return result;
+    }
+    if ((config_.auto_modifiers && isModifierKey(key)) ||
+        (config_.auto_layers && isLayerShiftKey(key))) {
+      return key;
+    }
+    return cKey::clear;
+  }
+
+  // The timeout depends on what the glukey turns into, not which kind of `GlukeysKey`
+  // it came from
+  uint16_t timeout(Key glukey) const {
+    if (isModifierKey(glukey)) {
+      return config_.modifier_ttl;
+    }
+    if (isLayerShiftKey(glukey)) {
+      return config_.layer_ttl;
+    }
+    return config_.temp_ttl;
+  }
+
+  static bool isTrigger(Key key) {
+    if (KeyboardKey::verifyType(key)) {
+      return ! KeyboardKey(key).isModifier();
+    }
+    return ! LayerKey::verifyType(key);
+  }
+
+  bool anyTemp() const {
+    for (byte k = 0; k < key_count; ++k) {
+      if (state_[k] == State::pending || state_[k] == State::sticky) return true;
+    }
+    return false;
+  }
+
+  // Change a key's state. Leaving the `pending` & `sticky` states stops its timer.
+  void setState(byte k, State state) {
+    state_[k] = state;
+    if (state != State::pending && state != State::sticky) {
+      cancelTimer(k);
+    }
+  }
+  void setPending(byte k, uint16_t ttl) {
+    state_[k] = State::pending;
+    cancelTimer(k);
+    // There are only `glukeys::timer_count` timers
+    if (ttl != 0 && timer_count_ < glukeys::timer_count) {
+      has_timer_[k] = true;
+      deadline_[k]  = now() + ttl;
+      ++timer_count_;
+    }
+  }
+  void cancelTimer(byte k) {
+    if (has_timer_[k]) {
+      has_timer_[k] = false;
+      --timer_count_;
+    }
+  }
+
+  void releaseAll(bool release_locked) {
+    for (byte k = 0; k < key_count; ++k) {
+      if (state_[k] == State::sticky || (release_locked && state_[k] == State::locked)) {
+        active_[k] = cKey::clear;
+      }
+      if (state_[k] != State::locked || release_locked) {
+        setState(k, State::clear);
+      }
+    }
+    trigger_ = no_key;
+  }
+
+#if defined(KALEIDOGLYPH_GLUKEYS_WITH_META)
+  void clearMeta() {
+    active_[meta_] = cKey::clear;
+    setState(meta_, State::clear);
+    meta_ = no_key;
+  }
+#endif
+};
+
+// ----------------------------------------------------------------------------------------
+// Test driver
+
+Controller controller;
+
+// In a sketch, the plugin is a global, so its state starts out zeroed (`Bitfield` has no
+// constructor). Each sequence gets a fresh copy of a global one that's never used.
+const glukeys::Plugin unused_plugin{glukey_table, controller};
+alignas(glukeys::Plugin) byte plugin_storage[sizeof(glukeys::Plugin)];
+glukeys::Plugin* plugin{nullptr};
+Model model;
+
+EventHandlerResult onKeyEvent(KeyEvent& event) {
+  return plugin->onKeyEvent(event);
+}
+
+std::mt19937 rng;
+
+unsigned randomBelow(unsigned n) {
+  return std::uniform_int_distribution<unsigned>(0, n - 1)(rng);
+}
+
+// The most recent steps, for reporting a failure
+constexpr unsigned history_size{48};
+char history[history_size][64];
+unsigned long step_count{0};
+
+void dumpHistory() {
+  unsigned long first = step_count > history_size ? step_count - history_size : 0;
+  for (unsigned long s = first; s < step_count; ++s) {
+    fprintf(stderr, "  %8lu %s\n", s, history[s % history_size]);
+  }
+}
+
+void onAbort(int) {
+  fprintf(stderr, "assertion failed; the last steps were:\n");
+  dumpHistory();
+}
+
+template<typename... Args>
+void record(const char* format, Args... args) {
+  snprintf(history[step_count % history_size], sizeof(history[0]), format, args...);
+  ++step_count;
+}
+
+bool fail(const char* what, byte k) {
+  fprintf(stderr, "mismatch after step %lu: %s at key %d\n", step_count - 1, what, k);
+  for (byte j = 0; j < key_count; ++j) {
+    fprintf(stderr, "  key %2d: plugin %d/%04X model %d/%04X\n", j,
+            int(plugin->state(KeyAddr{j})), controller[KeyAddr{j}].raw(),
+            int(model.state(j)), model.activeKey(j).raw());
+  }
+  fprintf(stderr, "  layers: host %X model %X\n",
+          unsigned(host::layerState()), unsigned(model.layerState()));
+  dumpHistory();
+  return false;
+}
+
+bool compareStates() {
+  for (byte k = 0; k < key_count; ++k) {
+    if (plugin->state(KeyAddr{k}) != model.state(k)) {
+      return fail("state", k);
+    }
+  }
+  return true;
+}
+
+// After a scan, all the plugin's queued releases have been sent, so the controller's
+// active keys should match, too
+bool compareKeys() {
+  for (byte k = 0; k < key_count; ++k) {
+    if (controller[KeyAddr{k}] != model.activeKey(k)) {
+      return fail("active key", k);
+    }
+  }
+  if (host::layerState() != model.layerState()) {
+    return fail("layers", 0);
+  }
+  return compareStates();
+}
+
+bool scan(uint16_t elapsed, bool quiet = false) {
+  host::advanceTime(elapsed);
+  if (! quiet) {
+    record("scan +%u", elapsed);
+  }
+  plugin->preKeyswitchScan();
+  model.scan();
+  return compareKeys();
+}
+
+const uint16_t ttl_choices[] = {0, 150, 700, 2000};
+
+Config randomConfig() {
+  Config config;
+  config.behaviour      = Behaviour(randomBelow(glukeys::behaviour_count));
+  config.auto_modifiers = randomBelow(4) != 0;
+  config.auto_layers    = randomBelow(2) != 0;
+  config.temp_ttl       = ttl_choices[randomBelow(4)];
+  config.modifier_ttl   = ttl_choices[randomBelow(4)];
+  config.layer_ttl      = ttl_choices[randomBelow(4)];
+  config.meta_ttl       = ttl_choices[randomBelow(4)];
+  return config;
+}
+
+struct Totals {
+  unsigned long sequences;
+  unsigned long events;
+  unsigned long max_glukeys;
+} totals;
+
+// Run one random sequence of `length` steps, starting from a new plugin. Returns `false`
+// if the plugin & the model disagreed.
+bool runSequence(unsigned long length) {
+  host::reset();
+  // Start somewhere other than zero, sometimes close to the 16-bit timer rollover
+  host::setTime(randomBelow(2) ? 0xFFFF - randomBelow(3000) : randomBelow(100000));
+
+  plugin = new (plugin_storage) glukeys::Plugin(unused_plugin);
+
+  Config config = randomConfig();
+  plugin->setTimeout(config.temp_ttl);
+  plugin->setModifierTimeout(config.modifier_ttl);
+  plugin->setLayerTimeout(config.layer_ttl);
+#if defined(KALEIDOGLYPH_GLUKEYS_WITH_META)
+  plugin->setMetaTimeout(config.meta_ttl);
+#endif
+  plugin->setAutoModifiers(config.auto_modifiers);
+  plugin->setAutoLayers(config.auto_layers);
+  plugin->setBehaviour(config.behaviour);
+  model.begin(config);
+  record("begin behaviour %d ttl %u/%u/%u/%u auto %d/%d",
+         int(config.behaviour), config.temp_ttl, config.modifier_ttl, config.layer_ttl,
+         config.meta_ttl, config.auto_modifiers, config.auto_layers);
+
+  bool held[key_count] = {};
+  byte held_count{0};
+  bool active{true};
+  // How many keys the "typist" tends to hold at once in this sequence
+  byte max_held = 1 + randomBelow(12);
+
+  for (unsigned long step = 0; step < length; ++step) {
+    unsigned action = randomBelow(1000);
+
+    if (action < 300) {
+      if (! scan(1 + randomBelow(63))) return false;
+
+    } else if (action < 305) {
+      // A pause, long enough for timeouts to expire, with regular scans
+      unsigned pause = 300 + randomBelow(2700);
+      record("pause %u", pause);
+      for (unsigned elapsed = 0; elapsed < pause; elapsed += 50) {
+        if (! scan(50, true)) return false;
+      }
+
+    } else if (action < 307) {
+      if (active) {
+        record("deactivate");
+        plugin->deactivate();
+        model.deactivate();
+      } else {
+        record("activate");
+        plugin->activate();
+        model.activate();
+      }
+      active = ! active;
+      if (! scan(1)) return false;
+
+    } else if (action < 309) {
+      Behaviour behaviour = Behaviour(randomBelow(glukeys::behaviour_count));
+      record("behaviour %d", int(behaviour));
+      plugin->setBehaviour(behaviour);
+      model.setBehaviour(behaviour);
+
+    } else {
+      bool press = (held_count == 0) || (held_count < max_held && randomBelow(2));
+      byte k;
+      do {
+        k = randomBelow(key_count);
+      } while (held[k] == press);
+      held[k] = press;
+      if (press) {
+        ++held_count;
+        record("press %d", k);
+        host::press(KeyAddr{k});
+        model.press(k);
+      } else {
+        --held_count;
+        record("release %d", k);
+        host::release(KeyAddr{k});
+        model.release(k);
+      }
+      ++totals.events;
+      if (! compareStates()) return false;
+      if (model.glukeyCount() > totals.max_glukeys) {
+        totals.max_glukeys = model.glukeyCount();
+      }
+    }
+  }
+
+  // Release everything, and let all the timers expire
+  for (byte k = 0; k < key_count; ++k) {
+    if (held[k]) {
+      record("release %d", k);
+      host::release(KeyAddr{k});
+      model.release(k);
+    }
+  }
+  if (! active) {
+    plugin->activate();
+    model.activate();
+  }
+  record("pause 4000");
+  for (byte i = 0; i < 80; ++i) {
+    if (! scan(50, true)) return false;
+  }
+  ++totals.sequences;
+  return true;
+}
+
+} // namespace {
+
+
+int main(int argc, char* argv[]) {
+  unsigned long steps = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 2000000;
+  unsigned long seed  = (argc > 2) ? strtoul(argv[2], nullptr, 10) : 1;
+
+  setupKeymap();
+  host::setEventHandler(onKeyEvent);
+  signal(SIGABRT, onAbort);
+
+  auto start = std::chrono::steady_clock::now();
+  unsigned long done{0};
+  for (unsigned long sequence = 0; done < steps; ++sequence) {
+    // Each sequence gets its own seed, so a failure can be reproduced on its own
+    rng.seed(seed + sequence);
+    unsigned long length = 200 + randomBelow(3000);
+    if (! runSequence(length)) {
+      fprintf(stderr, "fuzz: failed in sequence %lu (run `fuzz 1 %lu` to repeat it)\n",
+              sequence, seed + sequence);
+      return 1;
+    }
+    done += length;
+  }
+  auto end = std::chrono::steady_clock::now();
+  double seconds = std::chrono::duration<double>(end - start).count();
+
+  printf("fuzz: %lu sequences, %lu steps, %lu key events, up to %lu glukeys at once\n",
+         totals.sequences, done, totals.events, totals.max_glukeys);
+  printf("fuzz: %.0f steps/sec, %.0f key events/sec\n",
+         done / seconds, totals.events / seconds);
+  return 0;
+}
@@ -0,0 +1,304 @@
+// -*- c++ -*-
+
+// Tests for glukey profiles (`Plugin::saveProfile()` & `restoreProfile()`):
+//
+//   - restoring a profile over a different set of `sticky` & `locked` glukeys sends events
+//     only for the keys that differ, and leaves exactly the profile's glukeys active
+//   - restoring while keys are physically held skips profile entries whose keys are
+//     held, doesn't let a held trigger release the restored glukeys, and leaves nothing
+//     stuck once they're released
+//   - a profile with all `max_profile_glukeys` entries can be saved & restored, and
+//     `saveProfile()` reports one more than that as not fitting
+//
+// Usage: profile
+
+#include <Arduino.h>
+
+#include <kaleidoglyph/Controller.h>
+#include <kaleidoglyph/Key.h>
+#include <kaleidoglyph/KeyAddr.h>
+
+#include "glukeys/Glukeys.h"
+#include "HostCore.h"
+
+#include <stdio.h>
+
+using namespace kaleidoglyph;
+using glukeys::Profile;
+using glukeys::State;
+
+namespace {
+
+unsigned failures{0};
+
+void check(bool ok, const char* what, long actual, long expected) {
+  if (! ok) {
+    fprintf(stderr, "profile: %s: got %ld, expected %ld\n", what, actual, expected);
+    ++failures;
+  }
+}
+
+// Modifier glukeys (left control to right gui) at 0-7, a layer-shift glukey at 8, a table
+// glukey at 9, more table glukeys at 10-11, and letters at 20-23
+constexpr byte layer_glukey_addr{8};
+constexpr byte table_glukey_addr{9};
+constexpr byte letter_addr{20};
+
+const Key glukey_table[] = {KeyboardKey(0x04), KeyboardKey(0x05), KeyboardKey(0x06)};
+
+void setupKeymap() {
+  for (byte i = 0; i < 8; ++i) {
+    host::keymap[0][i] = glukeys::glukeysModifierKey(i);
+  }
+  host::keymap[0][layer_glukey_addr] = glukeys::glukeysLayerShiftKey(1);
+  for (byte i = 0; i < 3; ++i) {
+    host::keymap[0][table_glukey_addr + i] = glukeys::GlukeysKey{i};
+  }
+  for (byte i = 0; i < 4; ++i) {
+    host::keymap[0][letter_addr + i] = KeyboardKey(byte(0x10 + i));
+    host::keymap[1][letter_addr + i] = KeyboardKey(byte(0x20 + i));
+  }
+}
+
+Controller controller;
+glukeys::Plugin glukeys_plugin{glukey_table, controller};
+
+EventHandlerResult onKeyEvent(KeyEvent& event) {
+  return glukeys_plugin.onKeyEvent(event);
+}
+
+void scan() {
+  host::advanceTime(5);
+  glukeys_plugin.preKeyswitchScan();
+}
+
+void tap(byte k) {
+  host::press(KeyAddr{k});
+  scan();
+  host::release(KeyAddr{k});
+  scan();
+}
+
+// A glukey's state, for the check messages
+long state(byte k) {
+  return long(glukeys_plugin.state(KeyAddr{k}));
+}
+
+// Make glukey `k` `sticky` (one tap) or `locked` (two, with the standard behaviour)
+void activate(byte k, State state) {
+  tap(k);
+  if (state == State::locked) tap(k);
+}
+
+// Release all glukeys, and start again with nothing held & no stats
+void clearAll() {
+  glukeys_plugin.deactivate();
+  scan();
+  glukeys_plugin.activate();
+  host::reset();
+}
+
+struct Expected {
+  byte  addr;
+  State state;
+};
+
+// Check that the active glukeys are exactly `expected`, and that the report & layers
+// match them
+void checkActive(const char* what, const Expected* expected, byte count) {
+  for (byte k = 0; k < letter_addr; ++k) {
+    State state = State::clear;
+    for (byte n = 0; n < count; ++n) {
+      if (expected[n].addr == k) state = expected[n].state;
+    }
+    if (glukeys_plugin.state(KeyAddr{k}) != state) {
+      fprintf(stderr, "profile: %s: key %d is in state %ld, expected %d\n",
+              what, k, ::state(k), int(state));
+      ++failures;
+    }
+    if (k < 8) {
+      bool pressed = host::report().isPressed(byte(0xE0 + k));
+      check(pressed == (state != State::clear), what, pressed, state != State::clear);
+    }
+  }
+  bool layer = bitRead(host::layerState(), 1);
+  bool layer_expected = (glukeys_plugin.state(KeyAddr{layer_glukey_addr}) != State::clear);
+  check(layer == layer_expected, what, layer, layer_expected);
+}
+
+// Restore `profile` over a different set of glukeys, and check that only the differences
+// generated events
+void checkDiff() {
+  clearAll();
+  // Profile A: ctrl (0) `sticky`, shift (1) `locked`, alt (2) `sticky`, the layer shift
+  // `locked`
+  activate(0, State::sticky);
+  activate(1, State::locked);
+  activate(2, State::sticky);
+  activate(layer_glukey_addr, State::locked);
+  const Expected a[] = {
+    {0, State::sticky}, {1, State::locked}, {2, State::sticky},
+    {layer_glukey_addr, State::locked},
+  };
+  checkActive("profile A before saving", a, 4);
+  Profile profile_a;
+  check(glukeys_plugin.saveProfile(profile_a), "saving A", 0, 1);
+  check(profile_a.count == 4, "A's count", profile_a.count, 4);
+
+  // Profile B: shift (1) `sticky` instead, alt (2) the same, gui (3) `locked`, and the
+  // table glukey `sticky`; no ctrl & no layer shift
+  clearAll();
+  activate(1, State::sticky);
+  activate(2, State::sticky);
+  activate(3, State::locked);
+  activate(table_glukey_addr, State::sticky);
+  const Expected b[] = {
+    {1, State::sticky}, {2, State::sticky}, {3, State::locked},
+    {table_glukey_addr, State::sticky},
+  };
+  checkActive("profile B before saving", b, 4);
+  Profile profile_b;
+  check(glukeys_plugin.saveProfile(profile_b), "saving B", 0, 1);
+
+  // B -> A: gui & the table glukey get released, ctrl & the layer shift get pressed,
+  // shift just becomes `locked`, and alt is left alone
+  host::stats = host::Stats{};
+  glukeys_plugin.restoreProfile(profile_a);
+  scan();
+  checkActive("restoring A over B", a, 4);
+  check(host::stats.injected_releases == 2, "releases restoring A over B",
+        host::stats.injected_releases, 2);
+  check(host::stats.injected_presses == 2, "presses restoring A over B",
+        host::stats.injected_presses, 2);
+
+  // A -> A: nothing to do
+  host::stats = host::Stats{};
+  glukeys_plugin.restoreProfile(profile_a);
+  scan();
+  checkActive("restoring A over A", a, 4);
+  check(host::stats.injected_releases + host::stats.injected_presses == 0,
+        "events restoring A over A",
+        host::stats.injected_releases + host::stats.injected_presses, 0);
+
+  // A -> B, the other way around
+  host::stats = host::Stats{};
+  glukeys_plugin.restoreProfile(profile_b);
+  scan();
+  checkActive("restoring B over A", b, 4);
+  check(host::stats.injected_releases == 2, "releases restoring B over A",
+        host::stats.injected_releases, 2);
+  check(host::stats.injected_presses == 2, "presses restoring B over A",
+        host::stats.injected_presses, 2);
+
+  // The restored glukeys behave as usual: a letter releases the `sticky` ones, and
+  // leaves the `locked` one
+  tap(letter_addr);
+  const Expected b_after[] = {{3, State::locked}};
+  checkActive("B after a letter", b_after, 1);
+}
+
+// Restore a profile while some keys are physically held
+void checkHeld() {
+  clearAll();
+  activate(0, State::sticky);
+  activate(1, State::locked);
+  activate(layer_glukey_addr, State::sticky);
+  Profile profile;
+  glukeys_plugin.saveProfile(profile);
+  clearAll();
+
+  // Hold ctrl (in the profile, so it's `pending` now) and a letter, then restore
+  host::press(KeyAddr{byte(0)});
+  host::press(KeyAddr{letter_addr});
+  scan();
+  host::stats = host::Stats{};
+  glukeys_plugin.restoreProfile(profile);
+  scan();
+  // Ctrl is left as it was, since its key is in use; the others get pressed
+  check(glukeys_plugin.state(KeyAddr{byte(0)}) == State::pending, "held ctrl", state(0),
+        long(State::pending));
+  check(host::stats.injected_presses == 2, "presses restoring while held",
+        host::stats.injected_presses, 2);
+  check(host::stats.injected_releases == 0, "releases restoring while held",
+        host::stats.injected_releases, 0);
+  check(host::report().isPressed(0x10), "held letter", 0, 1);
+
+  // Releasing the letter that was held doesn't release the restored `sticky` glukeys
+  host::release(KeyAddr{letter_addr});
+  scan();
+  check(glukeys_plugin.state(KeyAddr{layer_glukey_addr}) == State::sticky,
+        "restored layer shift after the held letter's release", state(layer_glukey_addr),
+        long(State::sticky));
+
+  // Letting go of ctrl makes it `sticky`, as if the profile hadn't been restored, and the
+  // next letter (on layer 1) releases all of the `sticky` glukeys
+  host::release(KeyAddr{byte(0)});
+  scan();
+  const Expected restored[] = {
+    {0, State::sticky}, {1, State::locked}, {layer_glukey_addr, State::sticky},
+  };
+  checkActive("after releasing the held keys", restored, 3);
+  host::press(KeyAddr{letter_addr});
+  scan();
+  check(host::report().isPressed(0x20), "letter on the restored layer", 0, 1);
+  host::release(KeyAddr{letter_addr});
+  scan();
+  const Expected after[] = {{1, State::locked}};
+  checkActive("after the next letter", after, 1);
+
+  // Nothing stuck once all the glukeys are released
+  glukeys_plugin.deactivate();
+  scan();
+  glukeys_plugin.activate();
+  checkActive("after releasing everything", nullptr, 0);
+  host::Report empty{};
+  check(host::report() == empty, "report after releasing everything", 0, 1);
+}
+
+// A profile with every entry used, and one glukey more than that
+void checkFull() {
+  static_assert(glukeys::max_profile_glukeys == 8, "this test assumes 8 entries");
+  clearAll();
+  Expected full[8];
+  for (byte i = 0; i < 8; ++i) {
+    // The layer shift instead of right gui, so there's one of those too
+    byte k = (i == 7) ? layer_glukey_addr : i;
+    State state = (i % 3 == 0) ? State::locked : State::sticky;
+    activate(k, state);
+    full[i] = {k, state};
+  }
+  checkActive("8 glukeys before saving", full, 8);
+  Profile profile;
+  check(glukeys_plugin.saveProfile(profile), "saving 8", 0, 1);
+  check(profile.count == 8, "count of 8", profile.count, 8);
+
+  clearAll();
+  glukeys_plugin.restoreProfile(profile);
+  scan();
+  checkActive("8 glukeys restored", full, 8);
+  check(host::stats.injected_presses == 8, "presses restoring 8",
+        host::stats.injected_presses, 8);
+
+  // One more doesn't fit, but the first 8 are still saved
+  activate(table_glukey_addr, State::locked);
+  Profile overfull;
+  check(! glukeys_plugin.saveProfile(overfull), "saving 9", 1, 0);
+  check(overfull.count == 8, "count of 9", overfull.count, 8);
+}
+
+} // namespace {
+
+int main() {
+  setupKeymap();
+  host::setEventHandler(onKeyEvent);
+  glukeys_plugin.setTimeout(0);
+  checkDiff();
+  checkHeld();
+  checkFull();
+  if (failures != 0) {
+    fprintf(stderr, "profile: %u failures\n", failures);
+    return 1;
+  }
+  printf("profile: all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,337 @@
+// -*- c++ -*-
+
+// Replay captured typing through `glukeys::Plugin`, with a simulated scan clock, and
+// report for each session:
+//
+//   - histograms of the host time spent on each key event, and on each scan
+//     (`preKeyswitchScan()`)
+//   - the number of key events, injected events & HID reports
+//   - how many `sticky` glukeys were released by a trigger key, by a timeout, or some
+//     other way (the cancel glukey, or their own key)
+//   - with `--trace`, the plugin's own trace (`dumpTrace()`), which needs a build with
+//     `KALEIDOGLYPH_GLUKEYS_TRACE` (`make replay-trace`)
+//
+// A capture is a text file, one item per line:
+//
+//   session <name>             start a new session (with a fresh plugin & keyboard)
+//   timeout <ms>               set the plugin's timeout (`setTimeout()`)
+//   key <layer> <addr> <hex>   set a keymap entry (raw `Key` value) for this session
+//   <ms> p <addr>              a key press at time <ms> since the session started
+//   <ms> r <addr>              a key release
+//
+// Blank lines & lines starting with `#` are ignored. Events must be in time order. A
+// session starts with the default keymap (see `setupKeymap()`), which any `key` lines
+// change. Between events, the clock is advanced one scan at a time whenever glukeys has
+// something waiting (a timeout, a release or an LED update), and otherwise it skips ahead
+// to the next event.
+//
+// Usage: replay [-s scan_ms] [-t timeout_ms] [--trace] capture...
+
+#include <Arduino.h>
+
+#include <kaleidoglyph/Controller.h>
+#include <kaleidoglyph/Key.h>
+#include <kaleidoglyph/KeyAddr.h>
+#include <kaleidoglyph/cKey.h>
+
+#include "glukeys/Glukeys.h"
+#include "HostCore.h"
+
+#include <chrono>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace kaleidoglyph;
+
+namespace {
+
+const Key glukey_table[] = {
+  KeyboardKey(0x2A),
+};
+
+// The default keymap. Layer 0: letters at 0-25, digits at 26-35, space at 36, enter at
+// 37, modifier glukeys at 40-47, a layer-shift glukey at 48, and the cancel glukey at
+// 49. Layer 1: digits & symbols over the letters.
+void setupKeymap() {
+  memset(host::keymap, 0, sizeof(host::keymap));
+  for (byte i = 0; i < 26; ++i) {
+    host::keymap[0][i] = KeyboardKey(byte(0x04 + i));
+    host::keymap[1][i] = KeyboardKey(byte(0x1E + i % 20));
+  }
+  for (byte i = 0; i < 10; ++i) {
+    host::keymap[0][26 + i] = KeyboardKey(byte(0x1E + i));
+  }
+  host::keymap[0][36] = KeyboardKey(0x2C);
+  host::keymap[0][37] = KeyboardKey(0x28);
+  for (byte i = 0; i < 8; ++i) {
+    host::keymap[0][40 + i] = glukeys::glukeysModifierKey(i);
+  }
+  host::keymap[0][48] = glukeys::glukeysLayerShiftKey(1);
+  host::keymap[0][49] = glukeys::cGlukey::cancel;
+}
+
+Controller controller;
+
+// In a sketch, the plugin is a global, so its state starts out zeroed (`Bitfield` has no
+// constructor). Each session gets a fresh copy of a global one that's never used.
+const glukeys::Plugin unused_plugin{glukey_table, controller};
+alignas(glukeys::Plugin) byte plugin_storage[sizeof(glukeys::Plugin)];
+glukeys::Plugin* plugin{nullptr};
+
+// The looked-up value of the last key switch event
+Key last_event_key;
+
+EventHandlerResult onKeyEvent(KeyEvent& event) {
+  if (! event.state.isInjected()) {
+    last_event_key = event.key;
+  }
+  return plugin->onKeyEvent(event);
+}
+
+// A histogram of times (ns), in power-of-two buckets from "under 64" up
+constexpr byte histogram_bucket_count{12};
+
+struct Histogram {
+  unsigned long counts[histogram_bucket_count];
+  unsigned long total;
+  double        sum_ns;
+
+  void add(double ns) {
+    byte bucket{0};
+    for (double limit = 64; ns >= limit && bucket < histogram_bucket_count - 1; limit *= 2) {
+      ++bucket;
+    }
+    ++counts[bucket];
+    ++total;
+    sum_ns += ns;
+  }
+
+  void print(const char* name) const {
+    printf("  %s time (ns): %lu, mean %.0f\n", name, total, total ? sum_ns / total : 0.0);
+    for (byte bucket = 0; bucket < histogram_bucket_count; ++bucket) {
+      if (counts[bucket] == 0) continue;
+      if (bucket < histogram_bucket_count - 1) {
+        printf("    < %-8lu %10lu\n", 64UL << bucket, counts[bucket]);
+      } else {
+        printf("    more       %10lu\n", counts[bucket]);
+      }
+    }
+  }
+};
+
+// How `sticky` glukeys got released
+enum class Cause : byte {
+  trigger,
+  timeout,
+  other,
+};
+
+struct Session {
+  char          name[64];
+  bool          active;
+  uint32_t      time;
+  Histogram     event_times;
+  Histogram     scan_times;
+  unsigned long released[3];
+  unsigned long max_glukeys;
+};
+
+Session session;
+glukeys::State states[total_keys];
+uint16_t scan_interval{1};
+int timeout_override{-1};
+bool dump_trace{false};
+
+// Compare every key's state with what it was before, and count the `sticky` glukeys that
+// have been released since. A glukey released by its own key (`self`) isn't counted as
+// released by `cause`.
+void countReleases(Cause cause, KeyAddr self = cKeyAddr::invalid) {
+  unsigned long glukeys{0};
+  for (byte k = 0; k < total_keys; ++k) {
+    glukeys::State state = plugin->state(KeyAddr{k});
+    if (states[k] == glukeys::State::sticky && state == glukeys::State::clear) {
+      ++session.released[byte(KeyAddr{k} == self ? Cause::other : cause)];
+    }
+    if (state != glukeys::State::clear) ++glukeys;
+    states[k] = state;
+  }
+  if (glukeys > session.max_glukeys) session.max_glukeys = glukeys;
+}
+
+void scan() {
+  auto start = std::chrono::steady_clock::now();
+  plugin->preKeyswitchScan();
+  auto end = std::chrono::steady_clock::now();
+  session.scan_times.add(std::chrono::duration<double, std::nano>(end - start).count());
+  countReleases(Cause::timeout);
+}
+
+// Run the scans up to time `t` (since the start of the session)
+void runUntil(uint32_t t) {
+  while (session.time < t) {
+    uint16_t wait = plugin->timeUntilDeadline();
+    uint32_t next = session.time + scan_interval;
+    if (wait == glukeys::no_deadline) {
+      // Nothing will happen before the next event, so skip the idle scans
+      next = t;
+    } else if (wait > scan_interval) {
+      // Skip to the scan that will find the next timeout
+      next = session.time + (wait / scan_interval) * scan_interval;
+    }
+    if (next > t) next = t;
+    host::advanceTime(next - session.time);
+    session.time = next;
+    scan();
+  }
+}
+
+void keyEvent(uint32_t t, KeyAddr k, bool press) {
+  runUntil(t);
+  auto start = std::chrono::steady_clock::now();
+  if (press) {
+    host::press(k);
+  } else {
+    host::release(k);
+  }
+  auto end = std::chrono::steady_clock::now();
+  session.event_times.add(std::chrono::duration<double, std::nano>(end - start).count());
+  // Sticky glukeys get released by the trigger key's release, or its press (layer shifts
+  // & rollover), or by the cancel glukey
+  countReleases(last_event_key == glukeys::cGlukey::cancel ? Cause::other : Cause::trigger,
+                k);
+}
+
+void beginSession(const char* name) {
+  host::reset();
+  host::setTime(1000);
+  plugin = new (plugin_storage) glukeys::Plugin(unused_plugin);
+  if (timeout_override >= 0) {
+    plugin->setTimeout(timeout_override);
+  }
+  memset(&session, 0, sizeof(session));
+  snprintf(session.name, sizeof(session.name), "%s", name);
+  session.active = true;
+  for (byte k = 0; k < total_keys; ++k) {
+    states[k] = glukeys::State::clear;
+  }
+  setupKeymap();
+}
+
+void endSession() {
+  if (! session.active) return;
+  // Let any remaining timeouts expire, so they get counted
+  runUntil(session.time + 10000);
+  session.active = false;
+
+  printf("session %s: %.1f s\n", session.name, session.time / 1000.0);
+  printf("  key events %lu, injected presses %lu, injected releases %lu, reports %lu\n",
+         (unsigned long)host::stats.key_events,
+         (unsigned long)host::stats.injected_presses,
+         (unsigned long)host::stats.injected_releases,
+         (unsigned long)host::stats.reports);
+  printf("  sticky glukeys released by trigger %lu, timeout %lu, other %lu "
+         "(up to %lu glukeys at once)\n",
+         session.released[byte(Cause::trigger)], session.released[byte(Cause::timeout)],
+         session.released[byte(Cause::other)], session.max_glukeys);
+  session.event_times.print("event");
+  session.scan_times.print("scan");
+#if defined(KALEIDOGLYPH_GLUKEYS_TRACE)
+  if (dump_trace) {
+    plugin->dumpTrace(host::out);
+  }
+#endif
+}
+
+bool replayFile(const char* path) {
+  FILE* file = fopen(path, "r");
+  if (file == nullptr) {
+    fprintf(stderr, "replay: can't open %s\n", path);
+    return false;
+  }
+
+  char line[256];
+  unsigned long line_number{0};
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), file) != nullptr) {
+    ++line_number;
+    char* text = line + strspn(line, " \t");
+    text[strcspn(text, "\r\n")] = '\0';
+    if (*text == '\0' || *text == '#') continue;
+
+    char name[64];
+    unsigned long t, layer, addr, raw;
+    char action;
+    if (sscanf(text, "session %63s", name) == 1) {
+      endSession();
+      beginSession(name);
+      continue;
+    }
+    // Events & settings before the first `session` line go in an unnamed one
+    if (! session.active) {
+      beginSession(path);
+    }
+    if (sscanf(text, "timeout %lu", &t) == 1) {
+      // A timeout given on the command line overrides the capture's
+      if (timeout_override < 0) {
+        plugin->setTimeout(t);
+      }
+    } else if (sscanf(text, "key %lu %lu %lx", &layer, &addr, &raw) == 3 &&
+               layer < host::layer_count && addr < total_keys) {
+      host::keymap[layer][addr] = Key(uint16_t(raw));
+    } else if (sscanf(text, "%lu %c %lu", &t, &action, &addr) == 3 &&
+               (action == 'p' || action == 'r') && addr < total_keys) {
+      if (t < session.time) {
+        fprintf(stderr, "replay: %s:%lu: event out of order\n", path, line_number);
+        ok = false;
+      } else {
+        keyEvent(t, KeyAddr{byte(addr)}, action == 'p');
+      }
+    } else {
+      fprintf(stderr, "replay: %s:%lu: can't parse \"%s\"\n", path, line_number, text);
+      ok = false;
+    }
+  }
+  fclose(file);
+  if (ok) endSession();
+  session.active = false;
+  return ok;
+}
+
+} // namespace {
+
+
+int main(int argc, char* argv[]) {
+  host::setEventHandler(onKeyEvent);
+
+  int n = 1;
+  for (; n < argc && argv[n][0] == '-'; ++n) {
+    if (strcmp(argv[n], "--trace") == 0) {
+      dump_trace = true;
+    } else if (n + 1 == argc) {
+      break;
+    } else if (strcmp(argv[n], "-s") == 0) {
+      scan_interval = atoi(argv[++n]);
+    } else if (strcmp(argv[n], "-t") == 0) {
+      timeout_override = atoi(argv[++n]);
+    } else {
+      break;
+    }
+  }
+  if (n == argc || scan_interval == 0) {
+    fprintf(stderr, "usage: replay [-s scan_ms] [-t timeout_ms] [--trace] capture...\n");
+    return 2;
+  }
+#if ! defined(KALEIDOGLYPH_GLUKEYS_TRACE)
+  if (dump_trace) {
+    fprintf(stderr, "replay: --trace needs a build with KALEIDOGLYPH_GLUKEYS_TRACE "
+            "(`make replay-trace`)\n");
+    return 2;
+  }
+#endif
+  for (; n < argc; ++n) {
+    if (! replayFile(argv[n])) return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,210 @@
+// -*- c++ -*-
+
+// Tests for state slots (`KALEIDOGLYPH_GLUKEYS_STATE_SLOTS`), with the slot map built from
+// a `constexpr` keymap by `makeSlotMap()`. It checks the map itself, and then that the
+// keys with slots (including one that's only a GlukeysKey on another layer) work as
+// glukeys, that a key without one stays an ordinary key, and that nothing is left stuck.
+// The plugin is built with `KALEIDOGLYPH_GLUKEYS_CHECK_INVARIANTS` as well.
+//
+// A keymap with more GlukeysKey addresses than slots must not compile; that's checked by
+// `make compile-fail` (see `compile_fail/`).
+//
+// Usage: slots
+
+#include <Arduino.h>
+
+#include <kaleidoglyph/Controller.h>
+#include <kaleidoglyph/Key.h>
+#include <kaleidoglyph/KeyAddr.h>
+
+#include "glukeys/Glukeys.h"
+#include "HostCore.h"
+
+#include <stdio.h>
+
+using namespace kaleidoglyph;
+using glukeys::GlukeysKey;
+using glukeys::State;
+
+static_assert(glukeys::state_slot_count == 6,
+              "slots must be built with KALEIDOGLYPH_GLUKEYS_STATE_SLOTS=6");
+
+namespace {
+
+// GlukeysKeys at 0, 2 & 4 on layer 0, and at 1 & 5 on layer 1 only: five addresses, for
+// six slots. The left shift at 6 isn't a GlukeysKey, so it has no slot, even with
+// auto-modifiers on.
+constexpr byte layer_glukey_addr{4};
+constexpr byte layer1_glukey_addr{5};
+constexpr byte shift_addr{6};
+constexpr byte letter_addr{7};
+
+// The keymap is written out in full, like a sketch's would be. (GCC 12 can't copy the
+// elements of a partly initialized `constexpr` array of `Key`s in a constant expression.)
+constexpr Key no_key{};
+using glukeys::glukeysLayerShiftKey;
+using glukeys::glukeysModifierKey;
+
+constexpr Key keymap[2][total_keys] = {
+  {
+    GlukeysKey{0}, KeyboardKey(0x10), glukeysModifierKey(1), KeyboardKey(0x11),
+    glukeysLayerShiftKey(1), KeyboardKey(0x12), KeyboardKey(0xE1), KeyboardKey(0x13),
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+  },
+  {
+    KeyboardKey(0x20), GlukeysKey{1}, no_key, KeyboardKey(0x21),
+    no_key, glukeysModifierKey(2), no_key, KeyboardKey(0x23),
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+    no_key, no_key, no_key, no_key, no_key, no_key, no_key, no_key,
+  },
+};
+static_assert(total_keys == 64, "the keymap assumes 64 keys");
+
+const Key glukey_table[] = {KeyboardKey(0x04), KeyboardKey(0x05)};
+
+} // namespace {
+
+const PROGMEM glukeys::StateSlotMap glukeys::state_slot_map =
+    glukeys::makeSlotMap<glukeys::state_slot_count, keymap>();
+
+namespace {
+
+unsigned failures{0};
+
+void check(bool ok, const char* what, long actual, long expected) {
+  if (! ok) {
+    fprintf(stderr, "slots: %s: got %ld, expected %ld\n", what, actual, expected);
+    ++failures;
+  }
+}
+
+void checkMap() {
+  constexpr byte expected_addrs[] = {0, 1, 2, 4, 5};
+  for (byte i = 0; i < sizeof(expected_addrs); ++i) {
+    byte k = expected_addrs[i];
+    check(glukeys::state_slot_map.slots[k] == i, "slot of a GlukeysKey address",
+          glukeys::state_slot_map.slots[k], i);
+    check(glukeys::state_slot_map.addrs[i] == k, "address of a slot",
+          glukeys::state_slot_map.addrs[i], k);
+  }
+  byte unmapped{0};
+  for (byte k = 0; k < total_keys; ++k) {
+    if (glukeys::state_slot_map.slots[k] == glukeys::state_slot_count) ++unmapped;
+  }
+  check(unmapped == total_keys - sizeof(expected_addrs), "addresses without a slot",
+        unmapped, total_keys - sizeof(expected_addrs));
+}
+
+Controller controller;
+glukeys::Plugin glukeys_plugin{glukey_table, controller};
+
+EventHandlerResult onKeyEvent(KeyEvent& event) {
+  return glukeys_plugin.onKeyEvent(event);
+}
+
+void scan() {
+  host::advanceTime(5);
+  glukeys_plugin.preKeyswitchScan();
+}
+
+void press(byte k) {
+  host::press(KeyAddr{k});
+  scan();
+}
+void release(byte k) {
+  host::release(KeyAddr{k});
+  scan();
+}
+void tap(byte k) {
+  press(k);
+  release(k);
+}
+
+long state(byte k) {
+  return long(glukeys_plugin.state(KeyAddr{k}));
+}
+
+void checkKeys() {
+  for (byte layer = 0; layer < 2; ++layer) {
+    for (byte k = 0; k < total_keys; ++k) {
+      host::keymap[layer][k] = keymap[layer][k];
+    }
+  }
+  host::setEventHandler(onKeyEvent);
+  host::reset();
+  glukeys_plugin.setTimeout(0);
+  glukeys_plugin.setAutoModifiers();
+
+  // Two glukeys on layer 0 apply to the next key
+  tap(0);
+  tap(2);
+  check(state(0) == long(State::sticky), "table glukey", state(0), long(State::sticky));
+  check(state(2) == long(State::sticky), "modifier glukey", state(2), long(State::sticky));
+  press(letter_addr);
+  check(host::report().isPressed(0x04) && host::report().isPressed(0xE1) &&
+        host::report().isPressed(0x13), "report with two glukeys", 0, 1);
+  release(letter_addr);
+  check(state(0) == 0 && state(2) == 0, "glukeys after their trigger",
+        state(0) + state(2), 0);
+
+  // The GlukeysKeys that are only on layer 1 have slots too
+  tap(layer_glukey_addr);
+  check(state(layer_glukey_addr) == long(State::sticky), "layer shift glukey",
+        state(layer_glukey_addr), long(State::sticky));
+  tap(layer1_glukey_addr);
+  check(state(layer1_glukey_addr) == long(State::sticky), "glukey on layer 1",
+        state(layer1_glukey_addr), long(State::sticky));
+  tap(1);
+  check(state(1) == long(State::sticky), "table glukey on layer 1", state(1),
+        long(State::sticky));
+  press(letter_addr);
+  check(host::report().isPressed(0x05) && host::report().isPressed(0xE2) &&
+        host::report().isPressed(0x23), "report with layer 1 glukeys", 0, 1);
+  release(letter_addr);
+
+  // The auto-modifier key has no slot, so it's an ordinary key
+  tap(shift_addr);
+  check(state(shift_addr) == long(State::clear), "auto-modifier without a slot",
+        state(shift_addr), long(State::clear));
+  check(! host::report().isPressed(0xE1), "auto-modifier in the report after a tap", 1, 0);
+
+  // Nothing stuck
+  tap(0);
+  tap(2);
+  tap(2);
+  glukeys_plugin.deactivate();
+  scan();
+  glukeys_plugin.activate();
+  for (byte k = 0; k < total_keys; ++k) {
+    if (glukeys_plugin.state(KeyAddr{k}) != State::clear) {
+      check(false, "key left active", k, -1);
+    }
+  }
+  host::Report empty{};
+  check(host::report() == empty && host::layerState() == 1,
+        "report & layers after releasing everything", 0, 1);
+}
+
+} // namespace {
+
+int main() {
+  checkMap();
+  checkKeys();
+  if (failures != 0) {
+    fprintf(stderr, "slots: %u failures\n", failures);
+    return 1;
+  }
+  printf("slots: all checks passed\n");
+  return 0;
+}
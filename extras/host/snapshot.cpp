@@ -0,0 +1,216 @@
+// -*- c++ -*-
+
+// A stress test for the state snapshot (`KALEIDOGLYPH_GLUKEYS_SNAPSHOT`), built with the
+// thread sanitizer. One writer thread drives the plugin with random key events & scans,
+// and two reader threads copy its snapshot as fast as they can: one with
+// `readSnapshot()`, and one with `tryReadSnapshot()`, like an interrupt handler would.
+//
+// Each time a scan publishes, the writer logs the state of every key, as the plugin
+// itself reports it. Once they're all done, every copy a reader got must match the log
+// entry for its version exactly; a copy that mixes words from two publishes won't. The
+// writer also checks that `timeUntilDeadline()` is 0 whenever the plugin has a change that
+// hasn't been published yet.
+//
+// Usage: snapshot [steps] [seed]
+
+#include <Arduino.h>
+
+#include <kaleidoglyph/Controller.h>
+#include <kaleidoglyph/Key.h>
+#include <kaleidoglyph/KeyAddr.h>
+
+#include "glukeys/Glukeys.h"
+#include "HostCore.h"
+
+#include <atomic>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+using namespace kaleidoglyph;
+
+namespace {
+
+// Keys 0-39 are glukeys (a table entry each), and 40-47 are plain keys, to trigger them.
+// The rest of the keymap is empty.
+constexpr byte glukey_count{40};
+constexpr byte key_count{48};
+
+Key glukey_table[glukey_count];
+
+void setupKeymap() {
+  for (byte i = 0; i < glukey_count; ++i) {
+    glukey_table[i] = KeyboardKey(byte(0x04 + i));
+    host::keymap[0][i] = glukeys::GlukeysKey{i};
+  }
+  for (byte i = glukey_count; i < key_count; ++i) {
+    host::keymap[0][i] = KeyboardKey(byte(0x04 + i));
+  }
+}
+
+Controller controller;
+glukeys::Plugin glukeys_plugin{glukey_table, controller};
+
+EventHandlerResult onKeyEvent(KeyEvent& event) {
+  return glukeys_plugin.onKeyEvent(event);
+}
+
+typedef glukeys::Plugin::Snapshot Snapshot;
+
+// The state of every key, as of one publish
+struct States {
+  glukeys::State keys[total_keys];
+};
+
+// Written by the writer thread, and only read once it has finished
+std::vector<States> published;
+
+// Written by each reader thread, and only read once it has finished
+struct Reader {
+  std::vector<Snapshot> copies;
+  unsigned long attempts;
+};
+
+std::atomic<bool> done{false};
+
+constexpr unsigned long max_copies{200000};
+
+void read(Reader& reader, bool once) {
+  Snapshot snapshot;
+  while (! done.load(std::memory_order_relaxed)) {
+    ++reader.attempts;
+    if (once) {
+      if (! glukeys_plugin.tryReadSnapshot(snapshot)) continue;
+    } else {
+      glukeys_plugin.readSnapshot(snapshot);
+    }
+    // Only keep a copy when it's a new version, so the copies cover as many publishes as
+    // possible
+    if (reader.copies.empty() || reader.copies.back().version != snapshot.version) {
+      if (reader.copies.size() == max_copies) break;
+      reader.copies.push_back(snapshot);
+    }
+    // On a machine with only one core, give the writer a chance to publish again
+    std::this_thread::yield();
+  }
+}
+
+void logStates(States& states) {
+  for (byte k = 0; k < total_keys; ++k) {
+    states.keys[k] = glukeys_plugin.state(KeyAddr{k});
+  }
+}
+
+bool isUnpublished() {
+  States states;
+  logStates(states);
+  for (byte k = 0; k < total_keys; ++k) {
+    if (states.keys[k] != published.back().keys[k]) return true;
+  }
+  return false;
+}
+
+std::mt19937 rng;
+
+unsigned randomBelow(unsigned n) {
+  return std::uniform_int_distribution<unsigned>(0, n - 1)(rng);
+}
+
+bool write(unsigned long steps) {
+  States initial;
+  logStates(initial);
+  published.push_back(initial);
+
+  bool held[key_count] = {};
+  byte held_count{0};
+
+  for (unsigned long step = 0; step < steps; ++step) {
+    if (randomBelow(3) == 0) {
+      host::advanceTime(1 + randomBelow(10));
+      glukeys_plugin.preKeyswitchScan();
+      Snapshot snapshot;
+      glukeys_plugin.readSnapshot(snapshot);
+      if (snapshot.version / 2 == published.size()) {
+        States states;
+        logStates(states);
+        published.push_back(states);
+      } else if (snapshot.version / 2 + 1 != published.size()) {
+        fprintf(stderr, "snapshot: version %lu after %zu publishes\n",
+                (unsigned long)snapshot.version, published.size() - 1);
+        return false;
+      }
+      continue;
+    }
+    bool press = (held_count == 0) || (held_count < 6 && randomBelow(2));
+    byte k;
+    do {
+      k = randomBelow(8) ? randomBelow(glukey_count) : randomBelow(key_count);
+    } while (held[k] == press);
+    held[k] = press;
+    if (press) {
+      ++held_count;
+      host::press(KeyAddr{k});
+    } else {
+      --held_count;
+      host::release(KeyAddr{k});
+    }
+    if (isUnpublished() && glukeys_plugin.timeUntilDeadline() != 0) {
+      fprintf(stderr, "snapshot: timeUntilDeadline() is %u with a change unpublished\n",
+              glukeys_plugin.timeUntilDeadline());
+      return false;
+    }
+  }
+  return true;
+}
+
+bool check(const char* name, const Reader& reader) {
+  for (const Snapshot& snapshot : reader.copies) {
+    if (snapshot.version & 1 || snapshot.version / 2 >= published.size()) {
+      fprintf(stderr, "snapshot: %s read version %lu, which was never published\n",
+              name, (unsigned long)snapshot.version);
+      return false;
+    }
+    const States& states = published[snapshot.version / 2];
+    for (byte k = 0; k < total_keys; ++k) {
+      glukeys::State actual = glukeys::Plugin::state(snapshot, KeyAddr{k});
+      if (actual != states.keys[k]) {
+        fprintf(stderr, "snapshot: %s read key %d as %d in version %lu, but it was %d\n",
+                name, k, int(actual), (unsigned long)snapshot.version,
+                int(states.keys[k]));
+        return false;
+      }
+    }
+  }
+  printf("snapshot: %s made %lu attempts, and checked %zu versions\n",
+         name, reader.attempts, reader.copies.size());
+  return true;
+}
+
+} // namespace {
+
+int main(int argc, char* argv[]) {
+  unsigned long steps = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 300000;
+  unsigned long seed  = (argc > 2) ? strtoul(argv[2], nullptr, 10) : 1;
+
+  setupKeymap();
+  host::setEventHandler(onKeyEvent);
+  glukeys_plugin.setTimeout(0);
+  rng.seed(seed);
+
+  Reader blocking{}, interrupt{};
+  std::thread blocking_thread(read, std::ref(blocking), false);
+  std::thread interrupt_thread(read, std::ref(interrupt), true);
+  bool written = write(steps);
+  done = true;
+  blocking_thread.join();
+  interrupt_thread.join();
+
+  if (! written) return 1;
+  printf("snapshot: %lu steps, %zu publishes\n", steps, published.size() - 1);
+  if (! check("readSnapshot()", blocking) || ! check("tryReadSnapshot()", interrupt)) {
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,53 @@
+// -*- c++ -*-
+
+// A stand-in for the Arduino core, with just enough of it to build glukeys on a host. On
+// a host, PROGMEM data is in ordinary memory, so the `pgm_read_*()` macros are plain
+// loads. The AVR footprint builds (`extras/avr`) use these stubs too, but search them
+// after the system headers, so there the real `<avr/pgmspace.h>` gets used instead.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint8_t byte;
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bitWrite(value, bit, bitvalue) ((bitvalue) ? bitSet(value, bit) : bitClear(value, bit))
+
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+#else
+#define PROGMEM
+#define PSTR(string_literal) (string_literal)
+#define pgm_read_byte(addr) (*reinterpret_cast<const uint8_t*>(addr))
+#define pgm_read_word(addr) (*reinterpret_cast<const uint16_t*>(addr))
+#define pgm_read_ptr(addr) (*reinterpret_cast<const void* const*>(addr))
+#endif
+
+// A string in PROGMEM, as in the Arduino core
+class __FlashStringHelper;
+#define F(string_literal) \
+  (reinterpret_cast<const __FlashStringHelper*>(PSTR(string_literal)))
+
+#define DEC 10
+#define HEX 16
+
+// `millis()` is the simulated clock (the same as `Controller::scanStartTime()`), but
+// `micros()` is the host's real clock, so that the trace's event timer measures something.
+unsigned long millis();
+unsigned long micros();
+
+class Print {
+ public:
+  virtual size_t write(uint8_t c) = 0;
+
+  size_t print(const char* s);
+  size_t print(const __FlashStringHelper* s);
+  size_t print(unsigned long n, int base = DEC);
+  size_t println(const char* s = "");
+  size_t println(const __FlashStringHelper* s);
+  size_t println(unsigned long n, int base = DEC);
+};
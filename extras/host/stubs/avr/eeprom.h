@@ -0,0 +1,14 @@
+// -*- c++ -*-
+
+// A stand-in for avr-libc's EEPROM functions, backed by an array in host memory (see
+// `host::eeprom`). Addresses are offsets into that array.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint8_t eeprom_read_byte(const uint8_t* addr);
+void    eeprom_update_byte(uint8_t* addr, uint8_t value);
+void    eeprom_read_block(void* dst, const void* addr, size_t n);
+void    eeprom_update_block(const void* src, void* addr, size_t n);
@@ -0,0 +1,5 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <Arduino.h>
@@ -0,0 +1,28 @@
+// -*- c++ -*-
+
+// A stand-in for the Kaleidoglyph `Controller`. Its state (keymap, active keys, layers &
+// clock) is global, and is set up & inspected through the functions in `HostCore.h`.
+
+#pragma once
+
+#include <Arduino.h>
+
+#include <kaleidoglyph/Key.h>
+#include <kaleidoglyph/KeyAddr.h>
+#include <kaleidoglyph/KeyEvent.h>
+
+namespace kaleidoglyph {
+
+class Controller {
+ public:
+  static uint32_t scanStartTime();
+
+  // Look up `event.key` (if it's `cKey::clear`), run the event handler, and then update
+  // the active keys, the layer state, and the HID report
+  void handleKeyEvent(KeyEvent& event);
+
+  // The active key at `k`
+  Key& operator[](KeyAddr k);
+};
+
+} // namespace kaleidoglyph {
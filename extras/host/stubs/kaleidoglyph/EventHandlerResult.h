@@ -0,0 +1,12 @@
+// -*- c++ -*-
+
+#pragma once
+
+namespace kaleidoglyph {
+
+enum class EventHandlerResult {
+  proceed,
+  abort,
+};
+
+} // namespace kaleidoglyph {
@@ -0,0 +1,105 @@
+// -*- c++ -*-
+
+// A stand-in for the Kaleidoglyph `Key` types. The encoding is simplified, but it keeps
+// the properties glukeys relies on: `Key` is 16 bits, `cKey::clear` is zero, and each
+// type's `verifyType()` only matches its own keys.
+//
+//   0x0002-0x3FFF: KeyboardKey (keycode in the low byte, modifier flags above it)
+//   0x40nn:        LayerKey (shift to layer `nn`)
+//   0x8000-0xFFFF: PluginKey (id in bits 8-14, data in the low byte)
+
+#pragma once
+
+#include <Arduino.h>
+
+namespace kaleidoglyph {
+
+class Key {
+ public:
+  constexpr Key() : raw_(0) {}
+  constexpr explicit Key(uint16_t raw) : raw_(raw) {}
+
+  constexpr uint16_t raw() const {
+    return raw_;
+  }
+  constexpr bool operator==(Key other) const {
+    return raw_ == other.raw_;
+  }
+  constexpr bool operator!=(Key other) const {
+    return raw_ != other.raw_;
+  }
+
+ private:
+  uint16_t raw_;
+};
+
+class KeyboardKey {
+ public:
+  static constexpr byte mod_keycode_offset{0xE0};
+
+  constexpr KeyboardKey(byte keycode, byte mods = 0) : keycode_(keycode), mods_(mods) {}
+  constexpr explicit KeyboardKey(Key key)
+      : keycode_(byte(key.raw())), mods_(byte(key.raw() >> 8)) {}
+
+  static constexpr bool verifyType(Key key) {
+    return key.raw() > 1 && key.raw() < 0x4000;
+  }
+
+  constexpr byte keycode() const {
+    return keycode_;
+  }
+  constexpr byte mods() const {
+    return mods_;
+  }
+  constexpr bool isModifier() const {
+    return keycode_ >= mod_keycode_offset && keycode_ < mod_keycode_offset + 8;
+  }
+
+  constexpr operator Key() const {
+    return Key(uint16_t(keycode_ | (mods_ << 8)));
+  }
+
+ private:
+  byte keycode_;
+  byte mods_;
+};
+
+class LayerKey {
+ public:
+  constexpr LayerKey(byte index) : index_(index) {}
+  constexpr explicit LayerKey(Key key) : index_(byte(key.raw())) {}
+
+  static constexpr bool verifyType(Key key) {
+    return (key.raw() & 0xFF00) == 0x4000;
+  }
+
+  constexpr byte index() const {
+    return index_;
+  }
+
+  constexpr operator Key() const {
+    return Key(uint16_t(0x4000 | index_));
+  }
+
+ private:
+  byte index_;
+};
+
+constexpr Key modifierKey(byte n) {
+  return KeyboardKey(byte(KeyboardKey::mod_keycode_offset + n));
+}
+constexpr Key layerShiftKey(byte n) {
+  return LayerKey(n);
+}
+constexpr bool isModifierKey(Key key) {
+  return KeyboardKey::verifyType(key) && KeyboardKey(key).isModifier();
+}
+constexpr bool isLayerShiftKey(Key key) {
+  return LayerKey::verifyType(key);
+}
+
+inline Key getProgmemKey(const Key& key) {
+  return key;
+}
+
+} // namespace kaleidoglyph {
@@ -0,0 +1,33 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <Arduino.h>
+
+#include <kaleidoglyph/Key.h>
+
+namespace kaleidoglyph {
+
+template<byte _id>
+class PluginKey {
+ public:
+  constexpr explicit PluginKey(byte data) : data_(data) {}
+  constexpr explicit PluginKey(Key key) : data_(byte(key.raw())) {}
+
+  static constexpr bool verifyType(Key key) {
+    return (key.raw() >> 8) == (0x80 | _id);
+  }
+
+  constexpr byte data() const {
+    return data_;
+  }
+
+  constexpr operator Key() const {
+    return Key(uint16_t(((0x80 | _id) << 8) | data_));
+  }
+
+ private:
+  byte data_;
+};
+
+} // namespace kaleidoglyph {
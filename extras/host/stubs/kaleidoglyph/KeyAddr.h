@@ -0,0 +1,42 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <Arduino.h>
+
+namespace kaleidoglyph {
+
+constexpr byte total_keys{64};
+
+class KeyAddr {
+ public:
+  constexpr KeyAddr() : addr_(0xFF) {}
+  constexpr explicit KeyAddr(byte addr) : addr_(addr) {}
+
+  constexpr byte addr() const {
+    return addr_;
+  }
+  constexpr bool isValid() const {
+    return addr_ < total_keys;
+  }
+
+  constexpr bool operator==(KeyAddr other) const {
+    return addr_ == other.addr_;
+  }
+  constexpr bool operator!=(KeyAddr other) const {
+    return addr_ != other.addr_;
+  }
+  KeyAddr& operator++() {
+    ++addr_;
+    return *this;
+  }
+
+ private:
+  byte addr_;
+};
+
+namespace cKeyAddr {
+constexpr KeyAddr invalid{0xFF};
+} // namespace cKeyAddr {
+
+} // namespace kaleidoglyph {
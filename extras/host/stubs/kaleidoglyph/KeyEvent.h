@@ -0,0 +1,18 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <kaleidoglyph/Key.h>
+#include <kaleidoglyph/KeyAddr.h>
+#include <kaleidoglyph/KeyState.h>
+#include <kaleidoglyph/cKey.h>
+
+namespace kaleidoglyph {
+
+struct KeyEvent {
+  KeyAddr  addr;
+  KeyState state;
+  Key      key{cKey::clear};
+};
+
+} // namespace kaleidoglyph {
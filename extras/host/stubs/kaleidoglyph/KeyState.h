@@ -0,0 +1,35 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <Arduino.h>
+
+namespace kaleidoglyph {
+
+// Bit 0: the key is now pressed; bit 1: it was pressed before; bit 2: injected
+class KeyState {
+ public:
+  constexpr explicit KeyState(byte state) : state_(state) {}
+
+  constexpr bool isInjected() const {
+    return state_ & 0b100;
+  }
+  constexpr bool toggledOn() const {
+    return (state_ & 0b11) == 0b01;
+  }
+  constexpr bool toggledOff() const {
+    return (state_ & 0b11) == 0b10;
+  }
+
+ private:
+  byte state_;
+};
+
+namespace cKeyState {
+constexpr KeyState press{0b001};
+constexpr KeyState release{0b010};
+constexpr KeyState injected_press{0b101};
+constexpr KeyState injected_release{0b110};
+} // namespace cKeyState {
+
+} // namespace kaleidoglyph {
@@ -0,0 +1,3 @@
+// -*- c++ -*-
+
+#pragma once
@@ -0,0 +1,12 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <kaleidoglyph/EventHandlerResult.h>
+#include <kaleidoglyph/KeyEvent.h>
+
+namespace kaleidoglyph {
+
+class EventHandler {};
+
+} // namespace kaleidoglyph {
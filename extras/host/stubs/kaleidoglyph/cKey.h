@@ -0,0 +1,12 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <kaleidoglyph/Key.h>
+
+namespace kaleidoglyph {
+namespace cKey {
+constexpr Key clear{0};
+constexpr Key blank{1};
+} // namespace cKey {
+} // namespace kaleidoglyph {
@@ -0,0 +1,13 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <kaleidoglyph/KeyAddr.h>
+
+namespace kaleidoglyph {
+namespace hooks {
+
+void setLedForeground(KeyAddr k);
+
+} // namespace hooks {
+} // namespace kaleidoglyph {
@@ -0,0 +1,31 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <Arduino.h>
+
+#include <kaleidoglyph/KeyAddr.h>
+
+namespace kaleidoglyph {
+
+struct Color {
+  byte r, g, b;
+  constexpr Color(byte r, byte g, byte b) : r(r), g(g), b(b) {}
+};
+
+class LedManager {
+ public:
+  void setKeyColor(KeyAddr, Color) {}
+};
+
+class LedForegroundMode {
+ public:
+  static LedManager& manager() {
+    static LedManager led_manager;
+    return led_manager;
+  }
+};
+
+typedef LedForegroundMode LedMode;
+
+} // namespace kaleidoglyph {
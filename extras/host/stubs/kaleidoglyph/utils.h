@@ -0,0 +1,13 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <Arduino.h>
+
+namespace kaleidoglyph {
+
+constexpr byte bitfieldByteSize(byte n) {
+  return (n + 7) / 8;
+}
+
+} // namespace kaleidoglyph {
@@ -0,0 +1,254 @@
+// -*- c++ -*-
+
+// A loopback test for glukeys state sync (`KALEIDOGLYPH_GLUKEYS_WITH_SYNC`). One plugin
+// (the sender) gets random key events, and its sync bytes are fed to a second plugin
+// (the receiver) over a simulated link. Sometimes the link is fast, and is drained in
+// random-sized pieces every scan; sometimes it's slow, and only passes a byte or two per
+// scan, so the sender's buffer overflows. After each burst of events, the link is left
+// fast & quiet for a full resync interval, and then the receiver must have the same
+// state as the sender for every key.
+//
+// There are 40 glukeys in the keymap, so full state messages can be large, and a slow
+// link will often have only read part of one when the buffer overflows.
+//
+// Before that, it checks that dropping exactly 32 or 64 messages (a whole cycle of
+// sequence numbers) is still noticed, and that `timeUntilDeadline()` includes the time
+// until the next full state message.
+//
+// Usage: sync [steps] [seed]
+
+#include <Arduino.h>
+
+#include <kaleidoglyph/Controller.h>
+#include <kaleidoglyph/Key.h>
+#include <kaleidoglyph/KeyAddr.h>
+
+#include "glukeys/Glukeys.h"
+#include "HostCore.h"
+
+#include <new>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace kaleidoglyph;
+
+namespace {
+
+// Keys 0-39 are glukeys (a table entry each), and 40-47 are plain keys, to trigger them
+constexpr byte glukey_count{40};
+constexpr byte key_count{48};
+
+Key glukey_table[glukey_count];
+
+void setupKeymap() {
+  for (byte i = 0; i < glukey_count; ++i) {
+    glukey_table[i] = KeyboardKey(byte(0x04 + i));
+    host::keymap[0][i] = glukeys::GlukeysKey{i};
+  }
+  for (byte i = glukey_count; i < key_count; ++i) {
+    host::keymap[0][i] = KeyboardKey(byte(0x04 + i));
+  }
+}
+
+Controller controller;
+
+// In a sketch, the plugin is a global, so its state starts out zeroed (`Bitfield` has no
+// constructor). Each sequence gets fresh copies of a global one that's never used.
+const glukeys::Plugin unused_plugin{glukey_table, controller};
+alignas(glukeys::Plugin) byte sender_storage[sizeof(glukeys::Plugin)];
+alignas(glukeys::Plugin) byte receiver_storage[sizeof(glukeys::Plugin)];
+glukeys::Plugin* sender{nullptr};
+glukeys::Plugin* receiver{nullptr};
+
+EventHandlerResult onKeyEvent(KeyEvent& event) {
+  return sender->onKeyEvent(event);
+}
+
+std::mt19937 rng;
+
+unsigned randomBelow(unsigned n) {
+  return std::uniform_int_distribution<unsigned>(0, n - 1)(rng);
+}
+
+struct Totals {
+  unsigned long events;
+  unsigned long bytes;
+  unsigned long checks;
+  unsigned long max_glukeys;
+} totals;
+
+// Move bytes from the sender to the receiver. A fast link passes everything that's
+// waiting, in pieces of random size; a slow one passes at most `max` bytes.
+void transfer(unsigned max) {
+  byte buffer[16];
+  while (max != 0) {
+    byte n = sender->readSyncBytes(buffer, byte(1 + randomBelow(max < 16 ? max : 16)));
+    if (n == 0) break;
+    receiver->applySyncBytes(buffer, n);
+    totals.bytes += n;
+    max -= n;
+  }
+}
+
+void scan(uint16_t ms, unsigned link_max) {
+  host::advanceTime(ms);
+  sender->preKeyswitchScan();
+  transfer(link_max);
+  receiver->preKeyswitchScan();
+  // The receiver's own sync bytes would go back to the sender in a real keyboard, but
+  // this only tests one direction
+  byte discard[16];
+  while (receiver->readSyncBytes(discard, sizeof(discard)) != 0) {}
+}
+
+constexpr unsigned fast_link{0xFFFF};
+
+bool checkStates() {
+  ++totals.checks;
+  unsigned long glukeys{0};
+  for (byte k = 0; k < key_count; ++k) {
+    glukeys::State expected = sender->state(KeyAddr{k});
+    glukeys::State actual   = receiver->state(KeyAddr{k});
+    if (expected != actual) {
+      fprintf(stderr, "sync: key %d is %d on the sender, but %d on the receiver\n",
+              k, int(expected), int(actual));
+      return false;
+    }
+    if (expected != glukeys::State::clear) ++glukeys;
+  }
+  if (glukeys > totals.max_glukeys) totals.max_glukeys = glukeys;
+  return true;
+}
+
+bool runSequence(unsigned long length) {
+  host::reset();
+  host::setTime(randomBelow(100000));
+
+  sender   = new (sender_storage) glukeys::Plugin(unused_plugin);
+  receiver = new (receiver_storage) glukeys::Plugin(unused_plugin);
+  sender->setTimeout(randomBelow(2) ? 0 : 1500);
+
+  bool held[key_count] = {};
+  byte held_count{0};
+  bool slow = false;
+
+  for (unsigned long step = 0; step < length; ++step) {
+    unsigned action = randomBelow(100);
+    if (action < 30) {
+      scan(1 + randomBelow(30), slow ? randomBelow(3) : fast_link);
+    } else if (action < 32) {
+      slow = ! slow;
+    } else if (action < 33) {
+      // Let the link catch up, with no key events for a full resync interval
+      for (unsigned elapsed = 0; elapsed <= glukeys::sync_resync_interval; elapsed += 20) {
+        scan(20, fast_link);
+      }
+      if (! checkStates()) return false;
+    } else {
+      bool press = (held_count == 0) || (held_count < 6 && randomBelow(2));
+      byte k;
+      do {
+        // Mostly glukeys, so lots of them build up between triggers
+        k = randomBelow(8) ? randomBelow(glukey_count) : randomBelow(key_count);
+      } while (held[k] == press);
+      held[k] = press;
+      if (press) {
+        ++held_count;
+        host::press(KeyAddr{k});
+      } else {
+        --held_count;
+        host::release(KeyAddr{k});
+      }
+      ++totals.events;
+    }
+  }
+  return true;
+}
+
+// Drop exactly `_drops` messages (one buffer's worth) from an encoder, and check that the
+// decoder notices, and ignores the deltas that follow, even though the sequence numbers
+// wrap around to where they were.
+template<byte _drops>
+bool checkDrops() {
+  glukeys::SyncEncoder<2 * _drops> encoder;
+  glukeys::SyncDecoder decoder;
+  auto transfer = [&encoder, &decoder]() {
+    unsigned updates{0};
+    byte b;
+    while (encoder.read(&b, 1) != 0) {
+      if (decoder.feed(b) == glukeys::SyncUpdate::state) ++updates;
+    }
+    return updates;
+  };
+
+  encoder.beginFullState(0, 0);
+  transfer();
+  for (byte i = 0; i <= _drops; ++i) {
+    encoder.recordChange(KeyAddr{byte(i % 8)}, 1);
+  }
+  encoder.recordChange(KeyAddr{0}, 2);
+  if (transfer() != 0) {
+    fprintf(stderr, "sync: a delta was applied after %d messages were dropped\n", _drops);
+    return false;
+  }
+  return true;
+}
+
+// Check that `timeUntilDeadline()` covers the full state messages
+bool checkDeadlines() {
+  host::reset();
+  sender   = new (sender_storage) glukeys::Plugin(unused_plugin);
+  receiver = new (receiver_storage) glukeys::Plugin(unused_plugin);
+  sender->setTimeout(0);
+  uint16_t initial = sender->timeUntilDeadline();
+  scan(0, fast_link);
+  uint16_t after_resync = sender->timeUntilDeadline();
+  host::advanceTime(400);
+  uint16_t later = sender->timeUntilDeadline();
+  // Overflow the buffer, with nothing reading it
+  for (byte k = 0; k < 16; ++k) {
+    host::press(KeyAddr{k});
+    host::release(KeyAddr{k});
+  }
+  uint16_t overflowed = sender->timeUntilDeadline();
+  if (initial != 0 || after_resync != glukeys::sync_resync_interval ||
+      later != glukeys::sync_resync_interval - 400 || overflowed != 0) {
+    fprintf(stderr, "sync: wrong deadlines: %u at start, %u after a resync, %u 400 ms "
+            "later, %u after an overflow\n", initial, after_resync, later, overflowed);
+    return false;
+  }
+  return true;
+}
+
+} // namespace {
+
+int main(int argc, char* argv[]) {
+  unsigned long steps = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 500000;
+  unsigned long seed  = (argc > 2) ? strtoul(argv[2], nullptr, 10) : 1;
+
+  setupKeymap();
+  host::setEventHandler(onKeyEvent);
+
+  if (! checkDrops<32>() || ! checkDrops<64>() || ! checkDeadlines()) {
+    return 1;
+  }
+
+  unsigned long done{0};
+  for (unsigned long sequence = 0; done < steps; ++sequence) {
+    // Each sequence gets its own seed, so a failure can be reproduced on its own
+    rng.seed(seed + sequence);
+    unsigned long length = 500 + randomBelow(5000);
+    if (! runSequence(length)) {
+      fprintf(stderr, "sync: failed in sequence %lu (run `sync 1 %lu` to repeat it)\n",
+              sequence, seed + sequence);
+      return 1;
+    }
+    done += length;
+  }
+
+  printf("sync: %lu steps, %lu key events, %lu bytes sent, %lu checks, "
+         "up to %lu glukeys at once\n",
+         done, totals.events, totals.bytes, totals.checks, totals.max_glukeys);
+  return 0;
+}
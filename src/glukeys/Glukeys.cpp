@@ -5,6 +5,7 @@
 
 #include <Arduino.h>
 
+#include <assert.h>
 #include <kaleidoglyph/Controller.h>
 #include <kaleidoglyph/Key.h>
 #include <kaleidoglyph/KeyAddr.h>
@@ -26,6 +27,29 @@ EventHandlerResult Plugin::onKeyEvent(KeyEvent& event) {
     return EventHandlerResult::proceed;
   }
 
+  // Only physical events are timed. Glukeys' own injected events arrive while one of
+  // those is being handled, so they're already part of its time.
+  GLUKEYS_TRACE_EVENT_TIMER();
+
+#if defined(KALEIDOGLYPH_GLUKEYS_CHECK_INVARIANTS)
+  // This can't be checked before the injected events return: they can come from glukeys
+  // itself, in the middle of releasing glukeys, when the counts are only partly updated.
+  checkInvariants();
+#endif
+
+  // Any glukeys waiting to be released must go before this event, or they would still be
+  // active when it gets processed.
+  if (! release_queue_.isEmpty()) {
+    flushReleases();
+  }
+
+  // Most of the time, there are no active glukeys, and the key isn't one, so we can skip
+  // everything else. The keymap lookup has already been done, so `event.key` tells us if
+  // this key could become a glukey, regardless of which layers are active.
+  if (isIdle() && ! isGlukeyCandidate(event.key)) {
+    return EventHandlerResult::proceed;
+  }
+
   if (! plugin_active_) {
     if (isGlukeysKey(event.key)) {
       event.key = lookupGlukey(event.key);
@@ -33,178 +57,276 @@ EventHandlerResult Plugin::onKeyEvent(KeyEvent& event) {
     return EventHandlerResult::proceed;
   }
 
+  byte event_index;
   if (event.state.toggledOn()) {
+    event_index = press_event;
+    // If there's already a release trigger set, that means previously-set `sticky`
+    // glukeys need to be released before we proceed, or they would continue to be active
+    // past the key that should have released them. This has to happen before the key's
+    // own state is checked: when typing quickly, the next key might be a second tap of
+    // the same glukey (while the trigger is still held), which should make it `pending`
+    // again, not `locked`.
+    if (release_trigger_.isValid()) {
+      GLUKEYS_TRACE_RELEASE(rollover);
+      GLUKEYS_TRACE_TRIGGER_STOP();
+      releaseGlukeys();
+      flushReleases();
+    }
+  } else if (event.state.toggledOff()) {
+    event_index = release_event;
+  } else {
+    return EventHandlerResult::proceed;
+  }
 
-    // This key can't be `pending` if it's toggling on (unless another plugin is
-    // injecting this event), so if its `temp` bit is set, that means it's
-    // already in the `sticky` state, so this is the second press of the key,
-    // and we should therefore lock it. And if it is an virtual key event that
-    // isn't marked `injected`, we end up putting the key in the `clear` state,
-    // which is the best choice.
-    if (isTemp(event.addr)) {
-      // `sticky` => `locked`
-      clearTemp(event.addr);
-      // If this is a layer-shift key, unset `layer_shift_addr_`, which is only needed
-      // when a `sticky` key is being released to prevent it from interfering with
-      // subsequent keys.
-      if (event.addr == layer_shift_addr_) {
-        layer_shift_addr_ = cKeyAddr::invalid;
+  // Look up what this event does, given the key's current state. A `sticky` key that gets
+  // pressed again becomes `locked`, and a `locked` one becomes `clear` (depending on the
+  // behaviour); a `pending` key that gets released becomes `sticky`. A key that isn't a
+  // glukey yet gets handled by `onClearKeyPress()` or `onClearKeyRelease()`.
+  const State current_state = state(event.addr);
+  const byte entry =
+      pgm_read_byte(&transition_table[byte(behaviour_)][event_index][byte(current_state)]);
+  const State next_state = transitionState(entry);
+
+  switch (transitionAction(entry)) {
+    case Action::press :
+      return onClearKeyPress(event);
+    case Action::release :
+      return onClearKeyRelease(event);
+    case Action::remember_layer_shift :
+      // If this is a layer-shift key, make sure it gets released by the trigger key:
+      if (isLayerShiftKey(event.key)) {
+        sticky_layer_shift_ = true;
       }
-      return EventHandlerResult::abort;
-    }
+      break;
+    case Action::double_tap :
+      if (event.addr != last_tap_addr_ ||
+          uint16_t(uint16_t(Controller::scanStartTime()) - last_tap_time_) >=
+          double_tap_window) {
+        // Too slow to lock it, so release it instead
+        clearTemp(event.addr);
+        clearGlue(event.addr);
+        queueRelease(event.addr);
+        return EventHandlerResult::abort;
+      }
+      break;
+    case Action::none :
+      break;
+  }
 
-    // We have already eliminated the possibility of this key being in either the
-    // `pending` or `sticky` state, that means if its `sticky` bit is set, the key is
-    // `locked`. This is the third press, so we should clear it (and we don't need to
-    // clear `temp`, because we know it's already clear).
-    if (isGlue(event.addr)) {
-      // `locked` => `clear`
-      clearGlue(event.addr);
-      return EventHandlerResult::abort;
-    }
+  setTransitionState(event.addr, current_state, next_state);
+  // The key is (or was) a glukey, so the event stops here
+  return EventHandlerResult::abort;
+}
 
-    // If this is the escape-glukey
-    if (event.key == cGlukey::cancel) {
-#ifdef KALEIDOGLYPH_GLUKEYS_WITH_META
-      // If the meta-glukey was active, clear it:
-      if (meta_glukey_addr_.isValid()) {
-        clearMetaGlukey();
-        //controller_[meta_glukey_addr_] = cKey::clear;
-        //meta_glukey_addr_ = cKeyAddr::invalid;
-      }
-#endif
-      // Release all `sticky` & `locked` glukeys, and clear `pending` ones
-      releaseGlukeys(true);
-      return EventHandlerResult::abort;
-    }
 
+// Handle a press of a key that's in the `clear` state
+EventHandlerResult Plugin::onClearKeyPress(KeyEvent& event) {
+  // If this is the escape-glukey
+  if (event.key == cGlukey::cancel) {
 #ifdef KALEIDOGLYPH_GLUKEYS_WITH_META
-    // If this is the meta-glukey
-    if (event.key == cGlukey::meta) {
-      if (meta_glukey_addr_.isValid()) {
-        clearMetaGlukey();
-      }
-      setMetaGlukey(event.addr);
-      setTemp(event.addr);
-      return EventHandlerResult::proceed;
-    }
-
-    // If the meta-glukey is active, it gets released first, regardless of what key was
-    // pressed. Next, the current key becomes a glukey.
+    // If the meta-glukey was active, clear it:
     if (meta_glukey_addr_.isValid()) {
-      if (isTemp(meta_glukey_addr_)) {
-        if (isGlue(meta_glukey_addr_)) {
-          // If the meta-glukey is `sticky`, release it
-          clearMetaGlukey();
-        } else {
-          // It is being used chorded, so `pending` => `clear`
-          clearTemp(meta_glukey_addr_);
-        }
-      }
-      if (isGlukeysKey(event.key)) {
-        event.key = lookupGlukey(event.key);
-      }
-      // `clear` => `locked`
-      setGlue(event.addr);
-      return EventHandlerResult::proceed;
+      clearMetaGlukey();
+      //controller_[meta_glukey_addr_] = cKey::clear;
+      //meta_glukey_addr_ = cKeyAddr::invalid;
     }
 #endif
+    // Release all `sticky` & `locked` glukeys, and clear `pending` ones
+    GLUKEYS_TRACE_RELEASE(cancel);
+    releaseGlukeys(true);
+    return EventHandlerResult::abort;
+  }
 
-    // If there's already a release trigger set, that means previously-set `sticky`
-    // glukeys need to be released before we proceed, or they would continue to be active
-    // past the key that should have released them.
-    if (release_trigger_.isValid()) {
-      releaseGlukeys();
+#ifdef KALEIDOGLYPH_GLUKEYS_WITH_META
+  // If this is the meta-glukey
+  if (event.key == cGlukey::meta) {
+    if (meta_glukey_addr_.isValid()) {
+      clearMetaGlukey();
     }
+    setMetaGlukey(event.addr);
+    return EventHandlerResult::proceed;
+  }
 
-    // Determine if the pressed key is a glukey
-    const Key glukey = lookupGlukey(event.key);
-
-    // If it's not a GlukeysKey...
-    if (glukey == cKey::clear) {
-      // This `event.key` is not a glukey. Check to see if this key should be set as the
-      // trigger for release of `sticky` glukeys (and clearing of `pending` ones). Certain
-      // types of keys (modifiers & layer changes) shouldn't trigger release, and we
-      // should only set the trigger if there are any glukeys in the `pending` or `sticky`
-      // states.
-      if ((temp_key_count_ != 0) && isTriggerCandidate(event.key)) {
-        release_trigger_ = event.addr;
-        // Also, release any `sticky` layer-shift glukeys. The layer shift has already
-        // been applied to this trigger key (`event.key` was looked up from the shifted-to
-        // layer), and we don't want the layer shift to persist beyond that.
-        if (layer_shift_addr_ != cKeyAddr::invalid) {
-          KeyEvent event{layer_shift_addr_, cKeyState::injected_release};
-          controller_.handleKeyEvent(event);
-          layer_shift_addr_ = cKeyAddr::invalid;
-        }
+  // If the meta-glukey is active, it gets released first, regardless of what key was
+  // pressed. Next, the current key becomes a glukey.
+  if (meta_glukey_addr_.isValid()) {
+    if (isTemp(meta_glukey_addr_)) {
+      if (isGlue(meta_glukey_addr_)) {
+        // If the meta-glukey is `sticky`, release it
+        clearMetaGlukey();
+      } else {
+        // It is being used chorded, so `pending` => `clear`
+        clearTemp(meta_glukey_addr_);
       }
-      return EventHandlerResult::proceed;
     }
-    // If it's a GlukeysKey, but its index value is out of bounds, abort
-    if (glukey == cKey::blank) {
-      return EventHandlerResult::abort;
+    if (isGlukeysKey(event.key)) {
+      event.key = lookupGlukey(event.key);
     }
-    // Change the `event.key` value to the one looked up in the `glukeys_[]` array of
-    // `Key` objects (and let Controller restart the onKeyEvent() processing
-    event.key = glukey;
-    // `clear` => `pending`
-    setTemp(event.addr);
-    // Clear the release trigger whenever a glukey is pressed to prevent a bug caused by
-    // rollover from the previous (unreleased) trigger key when a new glukey is
-    // pressed. If we don't do this, the previous trigger key's release will also release
-    // the newly-pressed glukey before its trigger is pressed.
-    release_trigger_ = cKeyAddr::invalid;
+    // `clear` => `locked`
+    setGlue(event.addr);
     return EventHandlerResult::proceed;
   }
+#endif
 
-  if (event.state.toggledOff()) {
-    // If the key is `pending`, make it `sticky`
-    if (isTemp(event.addr)) {
-      // `pending` => `sticky`
-      setGlue(event.addr);
-      // If this is a layer-shift key, record its address for later release:
-      if (isLayerShiftKey(event.key)) {
-        layer_shift_addr_ = event.addr;
+  // Determine if the pressed key is a glukey
+  const Key glukey = lookupGlukey(event.key);
+
+  // If it's not a GlukeysKey...
+  if (glukey == cKey::clear) {
+    // This `event.key` is not a glukey. Check to see if this key should be set as the
+    // trigger for release of `sticky` glukeys (and clearing of `pending` ones). Certain
+    // types of keys (modifiers & layer changes) shouldn't trigger release, and we
+    // should only set the trigger if there are any glukeys in the `pending` or `sticky`
+    // states.
+    if ((temp_key_count_ != 0) && isTriggerCandidate(event.key)) {
+      release_trigger_ = event.addr;
+      GLUKEYS_TRACE(trigger, event.addr);
+      GLUKEYS_TRACE_TRIGGER_START();
+#if defined(KALEIDOGLYPH_GLUKEYS_ADAPTIVE_TIMEOUT)
+      // Only `sticky` glukeys are waiting for this trigger; a `pending` one is still
+      // being held, so the time since it was pressed says nothing about the timeout.
+      if (adaptive_timeout_enabled_ && hasStickyGlukeys()) {
+        adaptive_timeout_.addSample(uint16_t(Controller::scanStartTime()) -
+                                    last_tap_time_);
       }
-    }
-    // If the key is either `sticky` or `locked`, stop the release event
-    if (isGlue(event.addr)) {
-      return EventHandlerResult::abort;
-    }
-    // If the trigger key was released, also release any `sticky` glukeys
-    if (event.addr == release_trigger_) {
-      releaseGlukeys();
-    }
-#ifdef KALEIDOGLYPH_GLUKEYS_WITH_META
-    // If the released key was a `clear` meta-glukey, it needs to be cleared in a
-    // different way. Maybe it makes sense to move this to a pre-report hook?
-    if (event.addr == meta_glukey_addr_) {
-      clearMetaGlukey();
-      return EventHandlerResult::abort;
-    }
 #endif
+      // Also, release any `sticky` layer-shift glukeys. The layer shifts have already
+      // been applied to this trigger key (`event.key` was looked up from the shifted-to
+      // layer), and we don't want them to persist beyond that.
+      if (sticky_layer_shift_) {
+        releaseLayerShiftGlukeys();
+      }
+    }
+    return EventHandlerResult::proceed;
+  }
+  // If it's a GlukeysKey, but its index value is out of bounds, abort
+  if (glukey == cKey::blank) {
+    return EventHandlerResult::abort;
+  }
+  // Change the `event.key` value to the one looked up in the `glukeys_[]` array of
+  // `Key` objects (and let Controller restart the onKeyEvent() processing
+  uint16_t ttl = lookupTimeout(event.key, glukey);
+#if defined(KALEIDOGLYPH_GLUKEYS_ADAPTIVE_TIMEOUT)
+  if (adaptive_timeout_enabled_ && ttl != 0) {
+    ttl = adaptive_timeout_.timeout();
   }
+#endif
+  event.key = glukey;
+  // `clear` => `pending`
+  setTemp(event.addr, ttl);
+  last_tap_addr_ = event.addr;
+  last_tap_time_ = Controller::scanStartTime();
+  // There can't be a release trigger set here (any press releases it first), so the
+  // previous trigger key's release won't release this glukey before its own trigger is
+  // pressed.
+  return EventHandlerResult::proceed;
+}
 
+
+// Handle a release of a key that's in the `clear` state
+EventHandlerResult Plugin::onClearKeyRelease(KeyEvent& event) {
+  // If the trigger key was released, also release any `sticky` glukeys
+  if (event.addr == release_trigger_) {
+    GLUKEYS_TRACE_RELEASE(trigger);
+    GLUKEYS_TRACE_TRIGGER_STOP();
+    releaseGlukeys();
+  }
+#ifdef KALEIDOGLYPH_GLUKEYS_WITH_META
+  // If the released key was a `clear` meta-glukey, it needs to be cleared in a
+  // different way. Maybe it makes sense to move this to a pre-report hook?
+  if (event.addr == meta_glukey_addr_) {
+    clearMetaGlukey();
+    return EventHandlerResult::abort;
+  }
+#endif
   return EventHandlerResult::proceed;
 }
 
 
-// Time out glukeys in the `pending` & `sticky` states after the set timeout value
-// (`temp_ttl_`). The time for a `temp` state glukey gets extended whenever another `temp`
-// glukey is pressed.
+// Change a glukey's state as the transition table says. Transitions never set the `temp`
+// bit (only `onClearKeyPress()` does that, because it needs the key's timeout), so a
+// change in that bit always clears it.
+void Plugin::setTransitionState(KeyAddr k, State current_state, State next_state) {
+  byte changed_bits = byte(current_state) ^ byte(next_state);
+  if (changed_bits & byte(State::pending)) {
+    clearTemp(k);
+  }
+  if (changed_bits & byte(State::locked)) {
+    if (byte(next_state) & byte(State::locked)) {
+      setGlue(k);
+    } else {
+      clearGlue(k);
+    }
+  }
+}
+
+
+// Time out glukeys in the `pending` & `sticky` states after their timeout values. Each
+// glukey has its own timer, started when it entered the `pending` state, and only the
+// glukeys whose timers have expired get released.
 void Plugin::preKeyswitchScan() {
-  // If there are no `pending` or `sticky` keys, or if glukeys is configured to never time
-  // out `temp` glukeys, abort:
-  if (temp_key_count_ == 0 || temp_ttl_ == 0) return;
+  // Only glukeys with a timeout have a timer, so if none are running (e.g. because all
+  // `temp` glukeys are set to never time out), there's no need to check the time.
+  if (! timers_.isEmpty()) {
+    uint16_t current_time = Controller::scanStartTime();
+    for (KeyAddr k = timers_.popExpired(current_time);
+         k.isValid();
+         k = timers_.popExpired(current_time)) {
+      expireGlukey(k);
+    }
+  }
+
+  // Send all the releases from timeouts, trigger keys, and anything else since the last
+  // scan, together:
+  if (! release_queue_.isEmpty()) {
+    flushReleases();
+  }
+
+  if (! led_queue_.isEmpty()) {
+    flushLedUpdates();
+  }
+
+#if defined(KALEIDOGLYPH_GLUKEYS_WITH_SYNC)
+  if (sync_encoder_.isResyncDue(Controller::scanStartTime())) {
+    sendSyncState();
+  }
+#endif
+
+#if defined(KALEIDOGLYPH_GLUKEYS_SNAPSHOT)
+  // Publish all the changes since the last scan (from key events and timeouts) at once
+  if (snapshot_dirty_) {
+    snapshot_.publish(temp_bits_, glue_bits_);
+    snapshot_dirty_ = false;
+  }
+#endif
+
+#if defined(KALEIDOGLYPH_GLUKEYS_CHECK_INVARIANTS)
+  checkInvariants();
+#endif
+}
 
-  // Compare the difference between the current time and the last time a `temp` bit was
-  // set to the ttl. If we mixed different integer types, this would correct for overflow,
-  // so do it that way to stay consistent with other code:
+
+uint16_t Plugin::timeUntilDeadline() const {
+  if (! release_queue_.isEmpty() || ! led_queue_.isEmpty()) {
+    return 0;
+  }
+#if defined(KALEIDOGLYPH_GLUKEYS_SNAPSHOT)
+  // Readers of the snapshot are waiting for a change that hasn't been published yet
+  if (snapshot_dirty_) {
+    return 0;
+  }
+#endif
   uint16_t current_time = Controller::scanStartTime();
-  uint16_t elapsed_time = current_time - temp_start_time_;
-  if (elapsed_time > temp_ttl_) {
-    releaseGlukeys();
+  uint16_t result = timers_.timeUntilNextExpiry(current_time);
+#if defined(KALEIDOGLYPH_GLUKEYS_WITH_SYNC)
+  // The next full state message, which is due periodically, and right away after the
+  // outgoing buffer overflowed
+  uint16_t resync_time = sync_encoder_.timeUntilResync(current_time);
+  if (resync_time < result) {
+    result = resync_time;
   }
+#endif
+  return result;
 }
 
 
@@ -219,11 +341,27 @@ const Key Plugin::lookupGlukey(const Key key) const {
     result_key = getKey(glukey);
     if (result_key == cKey::clear) {
       byte index = glukey.data();
+#if defined(KALEIDOGLYPH_GLUKEYS_WITH_EEPROM)
+      // The EEPROM table can be changed at runtime, so its indices always get checked
+      if (eeprom_table_.isValid()) {
+        if (index < eeprom_table_.count()) {
+          return eeprom_table_.lookup(index);
+        }
+        return cKey::blank;
+      }
+#endif
+#if defined(KALEIDOGLYPH_GLUKEYS_VALIDATED_KEYMAP)
+      // The plugin can only be constructed with a `ValidatedKeymap`, so every GlukeysKey
+      // in the keymap has been checked at compile time, and there's no need to check
+      // `index` here.
+      return getProgmemKey(glukeys_[index]);
+#else
       if (index < glukey_count_) {
         return getProgmemKey(glukeys_[index]);
       } else {
         result_key = cKey::blank;
       }
+#endif
     }
   }
 
@@ -239,51 +377,356 @@ const Key Plugin::lookupGlukey(const Key key) const {
 }
 
 
+// Get the timeout value for a key that is about to become a `pending` glukey. `key` is
+// the value before lookup, and `glukey` is the looked-up value, which decides which kind
+// of glukey it is: a table entry that's a modifier gets the modifier timeout, just like a
+// modifier glukey or an auto-modifier. Only the other table entries can have their own
+// timeouts.
+uint16_t Plugin::lookupTimeout(const Key key, const Key glukey) const {
+  if (isModifierKey(glukey)) {
+    return modifier_ttl_;
+  }
+  if (isLayerShiftKey(glukey)) {
+    return layer_ttl_;
+  }
+#if defined(KALEIDOGLYPH_GLUKEYS_WITH_EEPROM)
+  // The per-entry timeouts belong to the PROGMEM table, not the one in EEPROM, which
+  // can have different entries (and a different number of them)
+  if (eeprom_table_.isValid()) {
+    return temp_ttl_;
+  }
+#endif
+  if (glukey_timeouts_ != nullptr && isGlukeysKey(key)) {
+    byte index = GlukeysKey{key}.data();
+    if (isTableIndex(index) && index < glukey_count_) {
+      return pgm_read_word(&glukey_timeouts_[index]);
+    }
+  }
+  return temp_ttl_;
+}
+
+
 // Clear all `pending` keys and release all `sticky` keys. If `release_locked_keys` is
 // `true`, also release `locked` glukeys. This can result in sending a release event for a
 // `locked` glukey that is still being held, but that seems to be a necessary evil that
 // I'm willing to live with.
 void Plugin::releaseGlukeys(bool release_locked_keys) {
-  for (byte r = 0; r < state_byte_count; ++r) {
-    // We expect that most keys won't have any glukey bits set, so if these eight keys are
-    // all `clear`, skip to the next batch:
-    if ((temp_bits_[r] | glue_bits_[r]) == 0) continue;
+  GLUKEYS_TRACE(release_all, release_trigger_);
+
+  if (active_list_overflow_) {
+    releaseGlukeysByScan(release_locked_keys);
+  } else {
+    // Visit only the glukeys that aren't `clear`, keeping the `locked` ones in the list
+    // (unless they're being released, too):
+    byte kept_count{0};
+    for (byte n = 0; n < active_count_; ++n) {
+      KeyAddr k = active_addrs_[n];
+      byte i = stateIndex(k);
+      bool was_temp = temp_bits_.read(i);
+      // All `pending` keys become `clear`:
+      temp_bits_.clear(i);
+      if (glue_bits_.read(i)) {
+        if (was_temp || release_locked_keys) {
+          glue_bits_.clear(i);
+          --glue_key_count_;
+          queueRelease(k);
+          queueLedUpdate(k);
+          noteStateChange(k);
+        } else {
+          active_addrs_[kept_count++] = k;
+        }
+      } else {
+        noteStateChange(k);
+      }
+    }
+    active_count_ = kept_count;
+  }
+
+  // There are no `sticky` or `pending` glukeys now, so reset the count and stop their
+  // timers:
+  temp_key_count_ = 0;
+  timers_.clear();
+
+  // Clear the release trigger:
+  release_trigger_ = cKeyAddr::invalid;
+
+  // `sticky` layer-shift glukeys always get released:
+  sticky_layer_shift_ = false;
+}
+
+
+// The same as above, but for when there were too many active glukeys to fit in the list,
+// so we have to scan the bitfields. Afterwards, the list gets rebuilt from the remaining
+// `locked` keys.
+void Plugin::releaseGlukeysByScan(bool release_locked_keys) {
+  for (byte w = 0; w < StateBitfield::word_count; ++w) {
+    bitfield_word_t& temp_bits = temp_bits_.word(w);
+    bitfield_word_t& glue_bits = glue_bits_.word(w);
+
+    // We expect that most keys won't have any glukey bits set, so if this word of keys
+    // is all `clear`, skip to the next batch:
+    if ((temp_bits | glue_bits) == 0) continue;
 
     // Bitfield of keys which will be released. Start with all `sticky` & `locked` keys:
-    byte release_bits = glue_bits_[r];
+    bitfield_word_t release_bits = glue_bits;
 
     if (release_locked_keys) {
       // Since both `sticky` & `locked` glukeys will be released, clear all glue bits:
-      glue_bits_[r] = 0;
+      glue_bits = 0;
     } else {
       // Remove the `locked` glukeys from the set that will be released, then clear only
       // the glue bits of the `sticky` glukeys:
-      release_bits &= temp_bits_[r];
-      glue_bits_[r] &= ~temp_bits_[r];
+      release_bits &= temp_bits;
+      glue_bits &= ~temp_bits;
     }
 
     // Clear all temp bits. All `pending` keys become `clear`:
-    temp_bits_[r] = 0;
-
-    // For each key that needs to be released, send the event:
-    for (byte c = 0; c < 8; ++c) {
-      if (bitRead(release_bits, c)) {
-        KeyAddr k{byte(r * 8 + c)};
-        KeyEvent event{k, cKeyState::injected_release};
-        controller_.handleKeyEvent(event);
-        //controller_[k] = cKey::clear;
+    temp_bits = 0;
+
+    // For each key that needs to be released, queue the event and the LED update. Each
+    // of these keys has just had its glue bit cleared.
+    StateBitfield::forEachSetBit(release_bits, w, [this](byte i) {
+        --glue_key_count_;
+        KeyAddr k = stateAddr(i);
+        queueRelease(k);
+        queueLedUpdate(k);
+      });
+  }
+
+  active_count_ = 0;
+  active_list_overflow_ = false;
+  glue_bits_.forEachSetBit([this](byte i) {
+      addActive(stateAddr(i));
+    });
+
+#if defined(KALEIDOGLYPH_GLUKEYS_WITH_SYNC)
+  // The `pending` keys that were cleared weren't recorded individually, so the other
+  // device needs the full state:
+  sync_encoder_.requestResync();
+#endif
+#if defined(KALEIDOGLYPH_GLUKEYS_SNAPSHOT)
+  snapshot_dirty_ = true;
+#endif
+}
+
+
+// Save the `sticky` & `locked` glukeys, along with their active `Key` values, which are
+// needed to recreate them.
+bool Plugin::saveProfile(Profile& profile) const {
+  profile.count       = 0;
+  profile.sticky_mask = 0;
+  bool fits{true};
+  glue_bits_.forEachSetBit([this, &profile, &fits](byte i) {
+      if (profile.count == max_profile_glukeys) {
+        fits = false;
+        return;
+      }
+      KeyAddr k = stateAddr(i);
+      if (temp_bits_.read(i)) {
+        bitSet(profile.sticky_mask, profile.count);
+      }
+      profile.addrs[profile.count] = k;
+      profile.keys[profile.count]  = controller_[k];
+      ++profile.count;
+    });
+  return fits;
+}
+
+
+// Switch to the `sticky` & `locked` glukeys in `profile`, sending events only for the
+// keys that actually change. All the releases go first, as one batch, then the presses.
+void Plugin::restoreProfile(const Profile& profile) {
+  // The profile entries that are already active glukeys
+  byte active_mask{0};
+
+  for (byte w = 0; w < StateBitfield::word_count; ++w) {
+    // This iterates over a copy of the word, so it's safe to clear bits in it
+    StateBitfield::forEachSetBit(glue_bits_.word(w), w,
+                                 [this, &profile, &active_mask](byte i) {
+        KeyAddr k = stateAddr(i);
+        const Key key = controller_[k];
+        byte n{0};
+        while (n < profile.count && (profile.addrs[n] != k || profile.keys[n] != key)) {
+          ++n;
+        }
+        if (n == profile.count) {
+          // Not in the profile, so release it
+          clearTemp(k);
+          clearGlue(k);
+          queueRelease(k);
+          return;
+        }
+        bitSet(active_mask, n);
+        // Already active, so it might just need to change between `sticky` & `locked`
+        if (bitRead(profile.sticky_mask, n)) {
+          if (! isTemp(k)) {
+            setTemp(k, lookupTimeout(key, key));
+            if (isLayerShiftKey(key)) {
+              sticky_layer_shift_ = true;
+            }
+          }
+        } else {
+          clearTemp(k);
+        }
+      });
+  }
+  flushReleases();
+
+  // Now press the ones that weren't already active
+  for (byte n = 0; n < profile.count; ++n) {
+    if (bitRead(active_mask, n)) continue;
+    KeyAddr k = profile.addrs[n];
+    if (! k.isValid() || ! hasStateSlot(stateIndex(k)) || controller_[k] != cKey::clear) {
+      continue;
+    }
+    const Key key = profile.keys[n];
+    KeyEvent event{k, cKeyState::injected_press, key};
+    controller_.handleKeyEvent(event);
+    setGlue(k);
+    if (bitRead(profile.sticky_mask, n)) {
+      setTemp(k, lookupTimeout(key, key));
+      if (isLayerShiftKey(key)) {
+        sticky_layer_shift_ = true;
       }
     }
   }
 
-  // There are no `sticky` or `pending` glukeys now, so reset the count:
-  temp_key_count_ = 0;
-
-  // Clear the release trigger:
+  // The restored `sticky` glukeys should apply to the next key, not get released by one
+  // that was pressed before they were restored.
   release_trigger_ = cKeyAddr::invalid;
 }
 
 
+// Time out a single `pending` or `sticky` glukey. A `pending` glukey (still held) becomes
+// `clear`, and a `sticky` one gets released.
+void Plugin::expireGlukey(KeyAddr k) {
+  GLUKEYS_TRACE(timeout, k);
+  GLUKEYS_TRACE_TIMEOUT();
+
+#ifdef KALEIDOGLYPH_GLUKEYS_WITH_META
+  if (k == meta_glukey_addr_) {
+    clearMetaGlukey();
+  } else
+#endif
+  if (isGlue(k)) {
+#if defined(KALEIDOGLYPH_GLUKEYS_ADAPTIVE_TIMEOUT)
+    // The typist took at least this long to get to the trigger key, which is the only
+    // way the estimate learns that the timeout is too short
+    if (adaptive_timeout_enabled_) {
+      adaptive_timeout_.addSample(adaptive_timeout_.timeout());
+    }
+#endif
+    // `sticky` => `clear`
+    clearTemp(k);
+    clearGlue(k);
+    queueRelease(k);
+  } else {
+    // `pending` => `clear`
+    clearTemp(k);
+  }
+
+  // If that was the last `temp` glukey, the release trigger has nothing left to do:
+  if (temp_key_count_ == 0) {
+    release_trigger_ = cKeyAddr::invalid;
+  }
+}
+
+
+// Release all the `sticky` layer-shift glukeys, when a trigger key is pressed. Their
+// releases are sent right away, before the trigger key's event finishes, so any key
+// pressed after it gets looked up without the layer shifts. Their state is cleared now,
+// so they won't be released a second time when the trigger key is released.
+//
+// Each one gets its own injected release event, even when several are released at once.
+// The layer state belongs to the controller, and the only way glukeys can change it is
+// by sending key events, so there's no way to drop all of the layer shifts in one update.
+// Usually there's only one `sticky` layer shift, anyway.
+void Plugin::releaseLayerShiftGlukeys() {
+  auto release_if_layer_shift = [this](KeyAddr k) {
+    if (isSticky(k) && isLayerShiftKey(controller_[k])) {
+      clearTemp(k);
+      clearGlue(k);
+      queueRelease(k);
+    }
+  };
+  if (active_list_overflow_) {
+    glue_bits_.forEachSetBit([this, &release_if_layer_shift](byte i) {
+        release_if_layer_shift(stateAddr(i));
+      });
+  } else {
+    // Go backwards through the list, because releasing a key moves the last entry into
+    // its place.
+    for (byte n = active_count_; n-- > 0; ) {
+      release_if_layer_shift(active_addrs_[n]);
+    }
+  }
+  sticky_layer_shift_ = false;
+}
+
+
+// Add a glukey to the queue of keys waiting to be released. Releases of keyboard keys are
+// normally sent once per scan, by `preKeyswitchScan()`, instead of re-entering the event
+// handler chain from wherever the release happens. Any other key (e.g. a layer shift) gets
+// its release sent right away, because the controller looks up the next key pressed
+// (possibly in the same scan) before glukeys gets a chance to flush the queue, and that
+// lookup has to see the new layer state. That release re-enters the event handler chain
+// from inside whatever called this, usually `onKeyEvent()` for a trigger key.
+void Plugin::queueRelease(KeyAddr k) {
+  if (! KeyboardKey::verifyType(controller_[k])) {
+    GLUKEYS_TRACE(release, k);
+    GLUKEYS_TRACE_INJECTED();
+    KeyEvent event{k, cKeyState::injected_release};
+    controller_.handleKeyEvent(event);
+    return;
+  }
+  if (release_queue_.isFull()) {
+    flushReleases();
+  }
+  release_queue_.push(k);
+}
+
+
+// Send the queued releases, in the order they were queued. Every key gets a real injected
+// release event, so other plugins see each of them. What's saved by queueing is the
+// re-entry: the events are all sent from one place, at the start of a scan (or just
+// before the next physical event), rather than from the middle of the state changes that
+// released the keys.
+void Plugin::flushReleases() {
+  while (! release_queue_.isEmpty()) {
+    KeyAddr k = release_queue_.pop();
+    GLUKEYS_TRACE(release, k);
+    GLUKEYS_TRACE_INJECTED();
+    KeyEvent event{k, cKeyState::injected_release};
+    controller_.handleKeyEvent(event);
+  }
+}
+
+
+// Record that a key's `sticky` or `locked` state has changed, so its LED gets updated
+// (once) at the start of the next scan.
+void Plugin::queueLedUpdate(KeyAddr k) {
+  for (byte i = 0; i < led_queue_.size(); ++i) {
+    if (led_queue_[i] == k) return;
+  }
+  if (led_queue_.isFull()) {
+    flushLedUpdates();
+  }
+  led_queue_.push(k);
+}
+
+
+// Tell the LED mode to repaint the keys whose state has changed. This is an ugly
+// workaround that I came up with to deal with the fact that the LED mode for glukeys isn't
+// the one that processes the events. I can't have the two depend on each other at
+// instantiation time, and I don't like any of the other solutions. I want Glukeys to be
+// easy to compile if there's no LED plugin, so this may be the best option.
+void Plugin::flushLedUpdates() {
+  while (! led_queue_.isEmpty()) {
+    hooks::setLedForeground(led_queue_.pop());
+  }
+}
+
+
 #ifdef KALEIDOGLYPH_GLUKEYS_WITH_META
 // Set meta-glukey
 void Plugin::setMetaGlukey(KeyAddr k) {
@@ -291,7 +734,7 @@ void Plugin::setMetaGlukey(KeyAddr k) {
 
   controller_[k] = cGlukey::meta;
   meta_glukey_addr_ = k;
-  setTemp(k);
+  setTemp(k, meta_ttl_);
 }
 
 // Clear meta-glukey
@@ -306,6 +749,98 @@ void Plugin::clearMetaGlukey() {
 #endif
 
 
+#if defined(KALEIDOGLYPH_GLUKEYS_WITH_SYNC)
+// Send the state of every glukey that isn't `clear`, so the other device can recover from
+// any lost messages. This scans the bitfields, but only happens about once a second (or
+// after the encoder's buffer overflows).
+void Plugin::sendSyncState() {
+  byte count{0};
+  for (byte w = 0; w < StateBitfield::word_count; ++w) {
+    count += __builtin_popcountl(temp_bits_.word(w) | glue_bits_.word(w));
+  }
+  if (! sync_encoder_.beginFullState(count, Controller::scanStartTime())) return;
+
+  for (byte w = 0; w < StateBitfield::word_count; ++w) {
+    StateBitfield::forEachSetBit(temp_bits_.word(w) | glue_bits_.word(w), w,
+                                 [this](byte i) {
+        KeyAddr k = stateAddr(i);
+        sync_encoder_.appendFullState(k, byte(state(k)));
+      });
+  }
+}
+
+
+// Decode bytes from the other device, and set the state of the keys they refer to
+void Plugin::applySyncBytes(const byte* data, byte length) {
+  for (byte n = 0; n < length; ++n) {
+    switch (sync_decoder_.feed(data[n])) {
+      case SyncUpdate::reset :
+        // A full state message lists every key that isn't `clear`, so start from scratch
+        for (byte w = 0; w < StateBitfield::word_count; ++w) {
+          StateBitfield::forEachSetBit(temp_bits_.word(w) | glue_bits_.word(w), w,
+                                       [this](byte i) {
+              setSyncedState(stateAddr(i), State::clear);
+            });
+        }
+        break;
+      case SyncUpdate::state :
+        setSyncedState(sync_decoder_.addr(), State(sync_decoder_.state() & 0b11));
+        break;
+      case SyncUpdate::none :
+        break;
+    }
+  }
+}
+
+
+// Set the state of one key from the other device, without recording it to be sent back
+void Plugin::setSyncedState(KeyAddr k, State state) {
+  if (! k.isValid()) return;
+  sync_encoder_.mute(true);
+  if (byte(state) & 0b01) {
+    setTemp(k, 0);
+  } else {
+    clearTemp(k);
+  }
+  if (byte(state) & 0b10) {
+    setGlue(k);
+  } else {
+    clearGlue(k);
+  }
+  sync_encoder_.mute(false);
+}
+#endif
+
+
+#if defined(KALEIDOGLYPH_GLUKEYS_CHECK_INVARIANTS)
+// Check that the plugin's state is consistent. This is expensive (especially the bit
+// count), so it's only meant for debugging builds, and for testing on a host.
+void Plugin::checkInvariants() const {
+  // The count of `pending` & `sticky` keys must match the bitfield
+  assert(temp_key_count_ == temp_bits_.count());
+  assert(glue_key_count_ == glue_bits_.count());
+  // Every `sticky` layer shift must get released by the next trigger key
+  if (! sticky_layer_shift_) {
+    glue_bits_.forEachSetBit([this](byte i) {
+        KeyAddr k = stateAddr(i);
+        assert(! (isTemp(k) && isLayerShiftKey(controller_[k])));
+      });
+  }
+  // Unless it overflowed, the active list must hold exactly the keys that aren't `clear`
+  if (! active_list_overflow_) {
+    byte active_count{0};
+    for (byte w = 0; w < StateBitfield::word_count; ++w) {
+      active_count += __builtin_popcountl(temp_bits_.word(w) | glue_bits_.word(w));
+    }
+    assert(active_count_ == active_count);
+    for (byte n = 0; n < active_count_; ++n) {
+      assert(state(active_addrs_[n]) != State::clear);
+    }
+  }
+}
+#endif
+
+
 // Test for types of keys that are eligible to trigger release of `sticky`
 // glukeys. Returns `true` if `key` will trigger release of `sticky` glukeys.
 bool isTriggerCandidate(const Key key) {
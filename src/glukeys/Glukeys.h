@@ -15,26 +15,111 @@
 #include <kaleidoglyph/utils.h>
 #include <kaleidoglyph/hooks.h>
 
+#include "glukeys/GlukeysAdaptive.h"
+#include "glukeys/GlukeysBitfield.h"
+#include "glukeys/GlukeysEeprom.h"
 #include "glukeys/GlukeysKey.h"
+#include "glukeys/GlukeysProfile.h"
+#include "glukeys/GlukeysQueue.h"
+#include "glukeys/GlukeysSlotMap.h"
+#include "glukeys/GlukeysSnapshot.h"
+#include "glukeys/GlukeysSync.h"
+#include "glukeys/GlukeysTimers.h"
+#include "glukeys/GlukeysTrace.h"
+#include "glukeys/GlukeysTransitions.h"
 
 namespace kaleidoglyph {
 namespace glukeys {
 
-// The number of bytes needed to store a bitfield with one bit per KeyAddr
-constexpr byte state_byte_count = bitfieldByteSize(total_keys);
+// By default, glukeys stores its state with one bit per KeyAddr. A keyboard with lots of
+// keys (but only a few that can become glukeys) can instead define
+// `KALEIDOGLYPH_GLUKEYS_STATE_SLOTS` as the number of keys that need state storage, and
+// define `glukeys::state_slot_map` in the sketch to say which keys those are, e.g.:
+//
+//   const PROGMEM glukeys::StateSlotMap glukeys::state_slot_map =
+//       glukeys::makeSlotMap<glukeys::state_slot_count, keymap>();
+//
+// Keys without a slot can't become glukeys.
+#if defined(KALEIDOGLYPH_GLUKEYS_STATE_SLOTS)
+constexpr byte state_slot_count = KALEIDOGLYPH_GLUKEYS_STATE_SLOTS;
+
+typedef SlotMap<state_slot_count> StateSlotMap;
+extern const PROGMEM StateSlotMap state_slot_map;
+
+// One extra bit is allocated, which is never set, for the keys that don't have a slot.
+// That way, reading state doesn't need to check for them.
+typedef Bitfield<bitfield_word_t, state_slot_count + 1> StateBitfield;
+#else
+constexpr byte state_slot_count = total_keys;
+
+typedef Bitfield<bitfield_word_t, state_slot_count> StateBitfield;
+#endif
+
+// The number of injected release events that can be waiting to be sent. If it fills up,
+// the waiting releases get sent early. Only keyboard keys are queued; layer shifts are
+// released right away.
+constexpr byte release_queue_capacity{8};
+
+// The number of keys that can be waiting for an LED update
+constexpr byte led_queue_capacity{8};
+
+#if defined(KALEIDOGLYPH_GLUKEYS_WITH_SYNC)
+// The number of outgoing sync bytes that can be waiting to be sent: enough for a full
+// state message with every key that has a state slot, plus some deltas
+constexpr uint16_t sync_buffer_size = 2 + 2 * state_slot_count + sync_delta_space;
+static_assert(sync_buffer_size <= 255,
+              "Too many state slots for sync; define KALEIDOGLYPH_GLUKEYS_STATE_SLOTS");
+#endif
+
+// The number of glukeys (in any state other than `clear`) that are tracked in a list, so
+// they can be released without scanning the state bitfields. If there are ever more than
+// this, the plugin falls back to scanning until the list can be rebuilt.
+constexpr byte max_active_glukeys{8};
 
 class Plugin : public EventHandler {
 
  public:
+#if defined(KALEIDOGLYPH_GLUKEYS_VALIDATED_KEYMAP)
+  // GlukeysKey indices aren't checked against the size of the table, so it has to come
+  // with proof that the keymap was checked at compile time.
+  template<const auto& _keymap, const auto& _glukeys>
+  Plugin(ValidatedKeymap<_keymap, _glukeys>, Controller& controller)
+      : Plugin(_glukeys, controller) {}
+
+  template<const auto& _keymap, const auto& _glukeys, byte _glukey_count>
+  Plugin(ValidatedKeymap<_keymap, _glukeys>,
+         const uint16_t (&timeouts)[_glukey_count],
+         Controller& controller)
+      : Plugin(_glukeys, timeouts, controller) {}
+
+ private:
+#endif
   template<byte _glukey_count>
   Plugin(const Key (&glukeys)[_glukey_count], Controller& controller)
-      : glukeys_(glukeys), glukey_count_(_glukey_count), controller_(controller) {}
+      : glukeys_(glukeys), glukey_count_(_glukey_count), controller_(controller) {
+    static_assert(isTableIndex(_glukey_count - 1),
+                  "Too many entries in glukeys table for GlukeysKey to address");
+  }
+
+  // Optionally, each entry in the `glukeys_[]` array can have its own timeout, stored in
+  // a parallel PROGMEM array. A timeout of zero means that entry never times out.
+  template<byte _glukey_count>
+  Plugin(const Key (&glukeys)[_glukey_count],
+         const uint16_t (&timeouts)[_glukey_count],
+         Controller& controller)
+      : glukeys_(glukeys), glukey_timeouts_(timeouts), glukey_count_(_glukey_count),
+        controller_(controller) {
+    static_assert(isTableIndex(_glukey_count - 1),
+                  "Too many entries in glukeys table for GlukeysKey to address");
+  }
 
+ public:
   void activate() {
     plugin_active_ = true;
   }
   void deactivate() {
     plugin_active_ = false;
+    GLUKEYS_TRACE_RELEASE(deactivate);
     releaseGlukeys(true);
   }
   void toggle() {
@@ -45,15 +130,75 @@ class Plugin : public EventHandler {
     }
   }
 
+  // There's no batched version of this for a whole scan's events: glukeys reads & changes
+  // the controller's active keys as it handles each event, so the controller has to apply
+  // one event before the next one reaches the plugin.
   EventHandlerResult onKeyEvent(KeyEvent& event);
 
   void preKeyswitchScan();
 
-  // Set the length of time from the last time a glukey entered the `pending` state before
-  // all `sticky` glukeys will release, and `pending` glukeys will be cleared.
+  // The number of ms until glukeys next needs `preKeyswitchScan()` to do anything: 0 if
+  // it has work waiting now, or `no_deadline` if nothing will happen before the next key
+  // event. A port that sleeps between scans can use this to decide how long to sleep.
+  // With state sync, it's never more than `sync_resync_interval`.
+  uint16_t timeUntilDeadline() const;
+
+  // Set the length of time (ms) from when a glukey enters the `pending` state until it
+  // will be released (if `sticky`) or cleared (if `pending`). This sets the timeout for
+  // all types of glukeys; the setters below can then override it for some of them. The
+  // value must be less than 32768, and 0 means never time out.
+  //
+  // Only `timer_count` (8) glukeys can have a timeout running at once. Any more `pending`
+  // or `sticky` glukeys than that don't time out at all; they're only released by their
+  // trigger key.
   void setTimeout(uint16_t ttl) {
-    temp_ttl_ = ttl;
+    temp_ttl_     = ttl;
+    modifier_ttl_ = ttl;
+    layer_ttl_    = ttl;
+#ifdef KALEIDOGLYPH_GLUKEYS_WITH_META
+    meta_ttl_     = ttl;
+#endif
+  }
+  // Timeout for modifier glukeys (including auto-modifiers)
+  void setModifierTimeout(uint16_t ttl) {
+    modifier_ttl_ = ttl;
+  }
+  // Timeout for layer-shift glukeys (including auto-layers)
+  void setLayerTimeout(uint16_t ttl) {
+    layer_ttl_ = ttl;
+  }
+#ifdef KALEIDOGLYPH_GLUKEYS_WITH_META
+  // Timeout for the meta-glukey
+  void setMetaTimeout(uint16_t ttl) {
+    meta_ttl_ = ttl;
   }
+#endif
+#if defined(KALEIDOGLYPH_GLUKEYS_ADAPTIVE_TIMEOUT)
+  // Replace the timeouts above (except those set to 0, which never time out) with one
+  // that adapts to how long the typist takes between a glukey and its trigger key
+  void setAdaptiveTimeout(bool on = true) {
+    adaptive_timeout_enabled_ = on;
+  }
+#endif
+
+#if defined(KALEIDOGLYPH_GLUKEYS_WITH_EEPROM)
+  // Use the glukeys table stored in EEPROM at `address`, if there's a valid one there.
+  // Returns `false` if there isn't, in which case the PROGMEM table is still used.
+  bool useEepromTable(uint16_t address) {
+    return eeprom_table_.begin(address);
+  }
+  // Copy the PROGMEM glukeys table to EEPROM at `address`, and start using it
+  void saveEepromTable(uint16_t address) {
+    eeprom_table_.format(address, glukeys_, glukey_count_);
+  }
+  // Change one entry in the EEPROM glukeys table. Returns `false` if there's no EEPROM
+  // table in use, or if `index` is out of range.
+  bool setEepromGlukey(byte index, Key key) {
+    if (index >= eeprom_table_.count()) return false;
+    eeprom_table_.update(index, key);
+    return true;
+  }
+#endif
 
   void setAutoModifiers(bool on = true) {
     auto_modifier_glukeys_ = on;
@@ -62,6 +207,77 @@ class Plugin : public EventHandler {
     auto_layer_glukeys_ = on;
   }
 
+  // Save the current `sticky` & `locked` glukeys to `profile`. Returns `false` if there
+  // were too many to fit (the ones that fit are still saved).
+  bool saveProfile(Profile& profile) const;
+  // Change the `sticky` & `locked` glukeys to match `profile`, all at once. Only the
+  // differences generate events: glukeys that aren't in the profile get released, ones
+  // that aren't active yet get an injected press, and ones that are already active just
+  // change state. A profile key whose address is already in use by a held key is
+  // skipped.
+  //
+  // Those events are sent by calling `Controller::handleKeyEvent()` directly. Elsewhere,
+  // glukeys only does that from `onKeyEvent()` & `preKeyswitchScan()`, so the event
+  // handlers are never nested more than one level (glukeys ignores injected events). If
+  // this gets called from another plugin's event handler, though, its events are nested
+  // one level deeper than that, which costs more stack; calling it from the sketch's
+  // loop (or a scan hook) doesn't.
+  void restoreProfile(const Profile& profile);
+
+  // Choose how glukeys respond to repeated taps (see `glukeys::Behaviour`)
+  void setBehaviour(Behaviour behaviour) {
+    behaviour_ = behaviour;
+  }
+
+#if defined(KALEIDOGLYPH_GLUKEYS_WITH_SYNC)
+  // Copy up to `max` bytes of encoded state changes to `buffer`, for the sketch to send
+  // to the other device. Returns the number of bytes copied.
+  byte readSyncBytes(byte* buffer, byte max) {
+    return sync_encoder_.read(buffer, max);
+  }
+  // Apply bytes received from the other device. The keys they refer to get their state
+  // set directly (with LED updates, but no key events and no timeouts), so this side
+  // should only mirror those keys, not process their events itself.
+  void applySyncBytes(const byte* data, byte length);
+#endif
+
+#if defined(KALEIDOGLYPH_GLUKEYS_SNAPSHOT)
+  // A copy of the state of all glukeys, as of the last time it was published (at the end
+  // of `preKeyswitchScan()`)
+  typedef StateSnapshot<StateBitfield>::Copy Snapshot;
+
+  // These are safe to call from another core or thread (`readSnapshot()`), or from an
+  // interrupt handler (`tryReadSnapshot()`, which returns `false` if it interrupted the
+  // plugin while it was publishing).
+  void readSnapshot(Snapshot& snapshot) const {
+    snapshot_.read(snapshot);
+  }
+  bool tryReadSnapshot(Snapshot& snapshot) const {
+    return snapshot_.tryRead(snapshot);
+  }
+  // Get the state of a key from a snapshot
+  static State state(const Snapshot& snapshot, KeyAddr k) {
+    byte i = stateIndex(k);
+    return State(snapshot.temp_bits.read(i) | (snapshot.glue_bits.read(i) << 1));
+  }
+#endif
+
+#if defined(KALEIDOGLYPH_GLUKEYS_TRACE)
+  // Print the trace buffer & counters (e.g. to `Serial`)
+  void dumpTrace(Print& out) const {
+    trace_.dump(out);
+  }
+  void resetTrace() {
+    trace_.reset();
+  }
+#endif
+
+  // Get the full state of a key with a single lookup
+  State state(KeyAddr k) const {
+    byte i = stateIndex(k);
+    return State(temp_bits_.read(i) | (glue_bits_.read(i) << 1));
+  }
+
   bool isSticky(KeyAddr k) const {
     return { isGlue(k) && isTemp(k) };
   }
@@ -78,31 +294,78 @@ class Plugin : public EventHandler {
 
  private:
   // An array of Glukey objects
-  const Key* const glukeys_;
-  const byte       glukey_count_;
+  const Key*      const glukeys_;
+  const uint16_t* const glukey_timeouts_{nullptr};
+  const byte            glukey_count_;
 
   // A reference to the keymap for lookups
   Controller& controller_;
 
+#if defined(KALEIDOGLYPH_GLUKEYS_WITH_EEPROM)
+  // The glukeys table in EEPROM, which replaces `glukeys_[]` if it's valid
+  EepromTable eeprom_table_;
+#endif
+
   // State variables -- one `temp` bit and one `sticky` bit for each valid `KeyAddr`
-  byte temp_bits_[state_byte_count];
-  byte glue_bits_[state_byte_count];
+  StateBitfield temp_bits_;
+  StateBitfield glue_bits_;
 
   bool plugin_active_{true};
 
   // How many `temp_bits_` bits are set?
   byte temp_key_count_{0};
+  // How many `glue_bits_` bits are set?
+  byte glue_key_count_{0};
+
+  // The addresses of all glukeys that aren't `clear`, in no particular order. If
+  // `active_list_overflow_` is set, some of them didn't fit.
+  KeyAddr active_addrs_[max_active_glukeys];
+  byte    active_count_{0};
+  bool    active_list_overflow_{false};
+
+  // Timeouts for each `pending` or `sticky` glukey
+  TimerWheel timers_;
+
+  // Glukeys waiting to be released
+  KeyAddrQueue<release_queue_capacity> release_queue_;
+
+  // Keys whose `sticky` or `locked` state has changed since the last LED update
+  KeyAddrQueue<led_queue_capacity> led_queue_;
 
-  // The last time a glukey's temp bit was set
-  uint16_t temp_start_time_{0};
-  // Reset glukeys temp bits after this much time (ms) 0 == never time out
+#if defined(KALEIDOGLYPH_GLUKEYS_TRACE)
+  Trace trace_;
+#endif
+
+#if defined(KALEIDOGLYPH_GLUKEYS_WITH_SYNC)
+  SyncEncoder<sync_buffer_size> sync_encoder_;
+  SyncDecoder sync_decoder_;
+#endif
+
+#if defined(KALEIDOGLYPH_GLUKEYS_SNAPSHOT)
+  StateSnapshot<StateBitfield> snapshot_;
+  bool snapshot_dirty_{false};
+#endif
+
+  // Timeouts (ms) for each kind of glukey. 0 == never time out
   uint16_t temp_ttl_{2000};
+  uint16_t modifier_ttl_{2000};
+  uint16_t layer_ttl_{2000};
+#ifdef KALEIDOGLYPH_GLUKEYS_WITH_META
+  uint16_t meta_ttl_{2000};
+#endif
+
+#if defined(KALEIDOGLYPH_GLUKEYS_ADAPTIVE_TIMEOUT)
+  AdaptiveTimeout adaptive_timeout_;
+  bool adaptive_timeout_enabled_{false};
+#endif
 
   // Signal that `sticky` glukeys should be released
   KeyAddr release_trigger_{cKeyAddr::invalid};
 
-  // The address of the current layer-shift glukey, if any
-  KeyAddr layer_shift_addr_{cKeyAddr::invalid};
+  // Set when a layer-shift glukey becomes `sticky`, so the next trigger key knows to look
+  // for layer shifts to release. It stays set until then, even if that glukey gets
+  // released some other way first; that only costs the trigger key a needless search.
+  bool sticky_layer_shift_{false};
 
 #ifdef KALEIDOGLYPH_GLUKEYS_WITH_META
   // Address of the active `meta_glukey`, if any
@@ -112,63 +375,197 @@ class Plugin : public EventHandler {
   bool auto_modifier_glukeys_{true};
   bool auto_layer_glukeys_{false};
 
+  Behaviour behaviour_{Behaviour::standard};
+
+  // The most recent glukey to become `pending`, and when, for `double_tap_lock` (and the
+  // adaptive timeout)
+  KeyAddr  last_tap_addr_{cKeyAddr::invalid};
+  uint16_t last_tap_time_{0};
+
+  // Return `true` if there are no active glukeys, and nothing waiting for a trigger. In
+  // that state, only a key that can become a glukey needs any processing.
+  bool isIdle() const {
+#ifdef KALEIDOGLYPH_GLUKEYS_WITH_META
+    if (meta_glukey_addr_.isValid()) return false;
+#endif
+    return (temp_key_count_ | glue_key_count_) == 0 && ! release_trigger_.isValid();
+  }
+  // Return `true` if any glukey is `sticky`
+  bool hasStickyGlukeys() const {
+    for (byte w = 0; w < StateBitfield::word_count; ++w) {
+      if ((temp_bits_.word(w) & glue_bits_.word(w)) != 0) return true;
+    }
+    return false;
+  }
+  bool isGlukeyCandidate(const Key key) const {
+    return (isGlukeysKey(key) ||
+            (auto_modifier_glukeys_ && isModifierKey(key)) ||
+            (auto_layer_glukeys_ && isLayerShiftKey(key)));
+  }
+
+  EventHandlerResult onClearKeyPress(KeyEvent& event);
+  EventHandlerResult onClearKeyRelease(KeyEvent& event);
+  void setTransitionState(KeyAddr k, State current_state, State next_state);
+
   const Key lookupGlukey(const Key key) const;
+  uint16_t lookupTimeout(const Key key, const Key glukey) const;
 
   void releaseGlukeys(bool release_locked_keys = false);
+  void releaseGlukeysByScan(bool release_locked_keys);
+  void expireGlukey(KeyAddr k);
+
+  void releaseLayerShiftGlukeys();
+
+  void queueRelease(KeyAddr k);
+  void flushReleases();
+
+  void queueLedUpdate(KeyAddr k);
+  void flushLedUpdates();
+
+#if defined(KALEIDOGLYPH_GLUKEYS_CHECK_INVARIANTS)
+  void checkInvariants() const;
+#endif
+
+#if defined(KALEIDOGLYPH_GLUKEYS_WITH_SYNC)
+  void sendSyncState();
+  void setSyncedState(KeyAddr k, State state);
+#endif
+  // Record that a key's state has changed, for the other device (if there is one) and
+  // the published snapshot
+  void noteStateChange(KeyAddr k) {
+#if defined(KALEIDOGLYPH_GLUKEYS_WITH_SYNC)
+    sync_encoder_.recordChange(k, byte(state(k)));
+#else
+    (void)k;
+#endif
+#if defined(KALEIDOGLYPH_GLUKEYS_SNAPSHOT)
+    snapshot_dirty_ = true;
+#endif
+  }
 
 #ifdef KALEIDOGLYPH_GLUKEYS_WITH_META
   void setMetaGlukey(KeyAddr k);
   void clearMetaGlukey();
 #endif
 
+  // Convert between a `KeyAddr` and its index in the state bitfields
+#if defined(KALEIDOGLYPH_GLUKEYS_STATE_SLOTS)
+  static byte stateIndex(KeyAddr k) {
+    return pgm_read_byte(&state_slot_map.slots[k.addr()]);
+  }
+  static KeyAddr stateAddr(byte i) {
+    return KeyAddr{pgm_read_byte(&state_slot_map.addrs[i])};
+  }
+  static bool hasStateSlot(byte i) {
+    return i != state_slot_count;
+  }
+#else
+  static byte stateIndex(KeyAddr k) {
+    return k.addr();
+  }
+  static KeyAddr stateAddr(byte i) {
+    return KeyAddr{i};
+  }
+  static bool hasStateSlot(byte) {
+    return true;
+  }
+#endif
+
   bool isTemp(KeyAddr k) const {
-    byte r = k.addr() / 8;
-    byte c = k.addr() % 8;
-    return bitRead(temp_bits_[r], c);
-  }
-  void setTemp(KeyAddr k) {
-    byte r = k.addr() / 8;
-    byte c = k.addr() % 8;
-    if (! isTemp(k)) {
-      bitSet(temp_bits_[r], c);
+    return temp_bits_.read(stateIndex(k));
+  }
+  void setTemp(KeyAddr k, uint16_t ttl) {
+    byte i = stateIndex(k);
+    if (! hasStateSlot(i)) return;
+    if (! temp_bits_.read(i)) {
+      if (! glue_bits_.read(i)) {
+        addActive(k);
+      }
+      temp_bits_.set(i);
       ++temp_key_count_;
+      GLUKEYS_TRACE_STATE(k);
+      noteStateChange(k);
+    }
+    if (ttl == 0) {
+      timers_.cancel(k);
+    } else {
+      uint16_t current_time = Controller::scanStartTime();
+      timers_.schedule(k, current_time + ttl, current_time);
     }
-    temp_start_time_ = uint16_t(Controller::scanStartTime());
   }
   void clearTemp(KeyAddr k) {
     if (isTemp(k)) {
-      byte r = k.addr() / 8;
-      byte c = k.addr() % 8;
-      bitClear(temp_bits_[r], c);
+      temp_bits_.clear(stateIndex(k));
       --temp_key_count_;
+      GLUKEYS_TRACE_STATE(k);
+      noteStateChange(k);
+      timers_.cancel(k);
+      // `sticky` => `locked` changes the key's color
+      if (isGlue(k)) {
+        queueLedUpdate(k);
+      } else {
+        removeActive(k);
+      }
     }
   }
 
   bool isGlue(KeyAddr k) const {
-    byte r = k.addr() / 8;
-    byte c = k.addr() % 8;
-    return bitRead(glue_bits_[r], c);
+    return glue_bits_.read(stateIndex(k));
   }
   void setGlue(KeyAddr k) {
-    byte r = k.addr() / 8;
-    byte c = k.addr() % 8;
-    bitSet(glue_bits_[r], c);
-    // This is an ugly workaround that I came up with to deal with the fact that the LED
-    // mode for glukeys isn't the one that processes the events. I can't have the two
-    // depend on each other at instantiation time, and I don't like any of the other
-    // solutions. I want Glukeys to be easy to compile if there's no LED plugin, so this
-    // may be the best option.
-    hooks::setLedForeground(k);
+    byte i = stateIndex(k);
+    if (! hasStateSlot(i)) return;
+    if (! glue_bits_.read(i)) {
+      if (! temp_bits_.read(i)) {
+        addActive(k);
+      }
+      ++glue_key_count_;
+    }
+    glue_bits_.set(i);
+    GLUKEYS_TRACE_STATE(k);
+    noteStateChange(k);
+    queueLedUpdate(k);
   }
   void clearGlue(KeyAddr k) {
-    byte r = k.addr() / 8;
-    byte c = k.addr() % 8;
-    bitClear(glue_bits_[r], c);
+    if (isGlue(k)) {
+      glue_bits_.clear(stateIndex(k));
+      --glue_key_count_;
+      GLUKEYS_TRACE_STATE(k);
+      noteStateChange(k);
+      queueLedUpdate(k);
+      if (! isTemp(k)) {
+        removeActive(k);
+      }
+    }
+  }
+
+  void addActive(KeyAddr k) {
+    if (active_count_ == max_active_glukeys) {
+      active_list_overflow_ = true;
+      return;
+    }
+    active_addrs_[active_count_++] = k;
+  }
+  void removeActive(KeyAddr k) {
+    for (byte n = 0; n < active_count_; ++n) {
+      if (active_addrs_[n] == k) {
+        active_addrs_[n] = active_addrs_[--active_count_];
+        return;
+      }
+    }
   }
 
 };
 
 bool isTriggerCandidate(const Key key);
 
+// Define `KALEIDOGLYPH_GLUKEYS_SRAM_BUDGET` (in bytes) to make the build fail if a
+// configuration change (more keys, trace buffer, EEPROM cache, etc.) makes the plugin's
+// state bigger than the sketch can afford.
+#if defined(KALEIDOGLYPH_GLUKEYS_SRAM_BUDGET)
+static_assert(sizeof(Plugin) <= KALEIDOGLYPH_GLUKEYS_SRAM_BUDGET,
+              "glukeys::Plugin is over its SRAM budget");
+#endif
+
 } // namespace qukeys {
 } // namespace kaleidoglyph {
@@ -0,0 +1,81 @@
+// -*- c++ -*-
+
+#pragma once
+
+// Define `KALEIDOGLYPH_GLUKEYS_ADAPTIVE_TIMEOUT` to allow glukeys to set its timeout from
+// the typist's own speed, instead of using a fixed value. While it's turned on (with
+// `Plugin::setAdaptiveTimeout()`), each time a trigger key is pressed while there are
+// `sticky` glukeys waiting for it, the time since the most recent glukey was tapped is
+// added to a running estimate, and the timeout becomes that average plus four times its
+// average deviation (like TCP's retransmission timer). A glukey that times out instead
+// counts as a sample of the current timeout. The first sample sets the average (with a
+// deviation of half of it), and the timeout stays at the default until there have been a
+// few more.
+#if defined(KALEIDOGLYPH_GLUKEYS_ADAPTIVE_TIMEOUT)
+
+#include <Arduino.h>
+
+namespace kaleidoglyph {
+namespace glukeys {
+
+// Limits (ms) on the adaptive timeout. Samples longer than the maximum are counted as the
+// maximum, which also keeps the fixed-point values below from overflowing.
+constexpr uint16_t adaptive_timeout_min{500};
+constexpr uint16_t adaptive_timeout_max{8000};
+
+// The number of samples before the adaptive timeout replaces the default
+constexpr byte adaptive_timeout_warmup{4};
+
+class AdaptiveTimeout {
+
+ public:
+  // Add one glukey-to-trigger time (ms), and update the timeout. This only uses shifts
+  // and adds, so it's cheap enough to do in the event handler on AVR.
+  void addSample(uint16_t elapsed) {
+    if (elapsed > adaptive_timeout_max) {
+      elapsed = adaptive_timeout_max;
+    }
+    if (sample_count_ == 0) {
+      mean_x8_ = elapsed << 3;
+      deviation_x4_ = elapsed << 1;
+    }
+    // mean += (elapsed - mean) / 8
+    int16_t error = int16_t(elapsed) - int16_t(mean_x8_ >> 3);
+    mean_x8_ += error;
+    // deviation += (|elapsed - mean| - deviation) / 4
+    if (error < 0) {
+      error = -error;
+    }
+    deviation_x4_ += error - (deviation_x4_ >> 2);
+
+    // timeout = mean + 4 * deviation
+    uint16_t timeout = (mean_x8_ >> 3) + deviation_x4_;
+    if (timeout < adaptive_timeout_min) {
+      timeout = adaptive_timeout_min;
+    } else if (timeout > adaptive_timeout_max) {
+      timeout = adaptive_timeout_max;
+    }
+    timeout_ = timeout;
+    if (sample_count_ < adaptive_timeout_warmup) {
+      ++sample_count_;
+    }
+  }
+
+  uint16_t timeout() const {
+    return (sample_count_ < adaptive_timeout_warmup) ? default_timeout : timeout_;
+  }
+
+ private:
+  // The estimates are stored scaled up (by 8 & 4, respectively), so that the small
+  // fractional updates aren't lost. Both are set by the first sample.
+  static constexpr uint16_t default_timeout{2000};
+  uint16_t mean_x8_{0};
+  uint16_t deviation_x4_{0};
+  uint16_t timeout_{default_timeout};
+  byte     sample_count_{0};
+};
+
+} // namespace glukeys {
+} // namespace kaleidoglyph {
+
+#endif
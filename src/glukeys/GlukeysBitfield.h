@@ -0,0 +1,92 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <Arduino.h>
+
+namespace kaleidoglyph {
+namespace glukeys {
+
+// The native word size to use for bitfield storage. On AVR, anything wider than a byte
+// costs extra instructions for every shift & mask, but 32-bit MCUs can test a whole word
+// of keys at once.
+#if defined(__AVR__)
+typedef uint8_t bitfield_word_t;
+#else
+typedef uint32_t bitfield_word_t;
+#endif
+
+// Return the index of the lowest set bit in `word`, which must be nonzero
+template<typename Word>
+inline
+byte countTrailingZeros(Word word) {
+  if (sizeof(Word) <= sizeof(unsigned)) {
+    return __builtin_ctz(word);
+  } else {
+    return __builtin_ctzl(word);
+  }
+}
+
+// A fixed-size bitfield, stored in words of type `Word`. There's no constructor, so a
+// `Bitfield` that's a member of a global object starts out all zeros, just like a plain
+// array.
+template<typename Word, uint16_t bit_count>
+class Bitfield {
+
+ public:
+  typedef Word word_type;
+
+  static constexpr byte word_bits  = sizeof(Word) * 8;
+  static constexpr byte word_count = (bit_count + word_bits - 1) / word_bits;
+
+  bool read(byte i) const {
+    return (words_[i / word_bits] >> (i % word_bits)) & 1;
+  }
+  void set(byte i) {
+    words_[i / word_bits] |= Word(1) << (i % word_bits);
+  }
+  void clear(byte i) {
+    words_[i / word_bits] &= ~(Word(1) << (i % word_bits));
+  }
+
+  // The number of set bits
+  byte count() const {
+    byte n{0};
+    for (byte w = 0; w < word_count; ++w) {
+      n += __builtin_popcountl(words_[w]);
+    }
+    return n;
+  }
+
+  Word& word(byte w) {
+    return words_[w];
+  }
+  Word word(byte w) const {
+    return words_[w];
+  }
+
+  // Call `function(i)` for each set bit `i` in `bits`, which is word number `w` of a
+  // `Bitfield`. This only iterates once per set bit, rather than once per bit.
+  template<typename Function>
+  static void forEachSetBit(Word bits, byte w, Function function) {
+    while (bits != 0) {
+      byte i = countTrailingZeros(bits);
+      bits &= bits - 1;
+      function(byte(w * word_bits + i));
+    }
+  }
+
+  // Call `function(i)` for each set bit `i`
+  template<typename Function>
+  void forEachSetBit(Function function) const {
+    for (byte w = 0; w < word_count; ++w) {
+      forEachSetBit(words_[w], w, function);
+    }
+  }
+
+ private:
+  Word words_[word_count];
+};
+
+} // namespace glukeys {
+} // namespace kaleidoglyph {
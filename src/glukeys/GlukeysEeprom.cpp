@@ -0,0 +1,86 @@
+// -*- c++ -*-
+
+#include "glukeys/GlukeysEeprom.h"
+
+#if defined(KALEIDOGLYPH_GLUKEYS_WITH_EEPROM)
+
+#include <Arduino.h>
+#include <avr/eeprom.h>
+
+#include <kaleidoglyph/Key.h>
+#include <kaleidoglyph/cKey.h>
+
+#include "glukeys/GlukeysKey.h"
+
+
+namespace kaleidoglyph {
+namespace glukeys {
+
+bool EepromTable::begin(uint16_t address) {
+  const byte* header = reinterpret_cast<const byte*>(address);
+  byte count = eeprom_read_byte(&header[2]);
+
+  count_ = 0;
+  if (eeprom_read_byte(&header[0]) != eeprom_table_magic ||
+      eeprom_read_byte(&header[1]) != eeprom_table_version ||
+      count == 0 || ! isTableIndex(count - 1)) {
+    return false;
+  }
+
+  base_address_ = address;
+  count_ = count;
+  clearCache();
+  return true;
+}
+
+
+void EepromTable::format(uint16_t address, const Key* progmem_keys, byte count) {
+  // The magic byte is written last, after everything else, so if this gets interrupted
+  // (e.g. by a power loss), `begin()` will find an invalid table, not a partial one.
+  byte* header = reinterpret_cast<byte*>(address);
+  eeprom_update_byte(&header[0], byte(~eeprom_table_magic));
+  eeprom_update_byte(&header[1], eeprom_table_version);
+  eeprom_update_byte(&header[2], count);
+
+  base_address_ = address;
+  for (byte i = 0; i < count; ++i) {
+    Key key = getProgmemKey(progmem_keys[i]);
+    eeprom_update_block(&key, reinterpret_cast<void*>(entryAddress(i)), sizeof(Key));
+  }
+  eeprom_update_byte(&header[0], eeprom_table_magic);
+
+  count_ = count;
+  clearCache();
+}
+
+
+Key EepromTable::lookup(byte index) const {
+  byte slot = index & (eeprom_cache_size - 1);
+  if (cache_indices_[slot] != index) {
+    eeprom_read_block(&cache_keys_[slot],
+                      reinterpret_cast<const void*>(entryAddress(index)),
+                      sizeof(Key));
+    cache_indices_[slot] = index;
+  }
+  return cache_keys_[slot];
+}
+
+
+void EepromTable::update(byte index, Key key) {
+  eeprom_update_block(&key, reinterpret_cast<void*>(entryAddress(index)), sizeof(Key));
+  byte slot = index & (eeprom_cache_size - 1);
+  cache_keys_[slot]    = key;
+  cache_indices_[slot] = index;
+}
+
+
+void EepromTable::clearCache() {
+  for (byte slot = 0; slot < eeprom_cache_size; ++slot) {
+    cache_indices_[slot] = no_index;
+  }
+}
+
+} // namespace glukeys {
+} // namespace kaleidoglyph {
+
+#endif
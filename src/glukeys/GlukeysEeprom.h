@@ -0,0 +1,77 @@
+// -*- c++ -*-
+
+#pragma once
+
+// Define `KALEIDOGLYPH_GLUKEYS_WITH_EEPROM` to allow the glukeys table to be loaded from
+// EEPROM (and changed at runtime) instead of being fixed in PROGMEM.
+#if defined(KALEIDOGLYPH_GLUKEYS_WITH_EEPROM)
+
+#include <Arduino.h>
+
+#include <kaleidoglyph/Key.h>
+
+namespace kaleidoglyph {
+namespace glukeys {
+
+// EEPROM table format:
+//
+//   byte 0:    `eeprom_table_magic`
+//   byte 1:    `eeprom_table_version`
+//   byte 2:    number of entries
+//   byte 3...: entries, one `Key` each
+//
+// The header is checked by `EepromTable::begin()`, so an uninitialized or incompatible
+// EEPROM table is ignored, and the PROGMEM table gets used instead. `format()` writes the
+// magic byte last, so a table that was only partly written is ignored, too.
+constexpr byte eeprom_table_magic{0x47};
+constexpr byte eeprom_table_version{1};
+constexpr byte eeprom_table_header_size{3};
+
+// The number of entries cached in SRAM. Must be a power of two.
+constexpr byte eeprom_cache_size{4};
+
+class EepromTable {
+
+ public:
+  // Read the table header at `address`. Returns `false` (and leaves the table unused) if
+  // there isn't a valid table there.
+  bool begin(uint16_t address);
+
+  // Write a new table at `address`, copying its entries from a PROGMEM table, and start
+  // using it.
+  void format(uint16_t address, const Key* progmem_keys, byte count);
+
+  bool isValid() const {
+    return count_ != 0;
+  }
+  byte count() const {
+    return count_;
+  }
+
+  // Look up entry `index`, which must be less than `count()`
+  Key lookup(byte index) const;
+
+  // Change entry `index`, which must be less than `count()`
+  void update(byte index, Key key);
+
+ private:
+  uint16_t base_address_{0};
+  byte     count_{0};
+
+  // A direct-mapped cache of recently-used entries. Each entry is stored in the slot
+  // given by the low bits of its index.
+  mutable byte cache_indices_[eeprom_cache_size];
+  mutable Key  cache_keys_[eeprom_cache_size];
+
+  static constexpr byte no_index{0xFF};
+
+  void clearCache();
+  uint16_t entryAddress(byte index) const {
+    return base_address_ + eeprom_table_header_size + index * sizeof(Key);
+  }
+};
+
+} // namespace glukeys {
+} // namespace kaleidoglyph {
+
+#endif
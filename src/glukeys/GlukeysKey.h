@@ -24,8 +24,6 @@ constexpr byte layer_mask           { 0b00'011111 }; // max < 32
 // Maybe I can use the third highest bit to indicate EEPROM layers?
 constexpr byte modifier_category_id { 0b11'000000 };
 constexpr byte modifier_mask        { 0b00'000111 }; // max <  8
-// I've got six bits left, so I could use the bottom three for the first modifier, and the
-// top three for another, but it's probably better to just use the bottom three.
 constexpr byte glukey_category_id   { 0b0'0000000 };
 constexpr byte glukey_mask          { 0b0'1111111 };
 
@@ -33,6 +31,25 @@ constexpr byte glukey_mask          { 0b0'1111111 };
 }  // namespace kaleidoglyph
 #endif
 
+// The packed modifier constants were added after `KALEIDOGLYPH_GLUKEYS_CONSTANTS_H`, so a
+// custom constants header doesn't have to define them. If it does, it should also define
+// `KALEIDOGLYPH_GLUKEYS_PACKED_MODIFIER_CONSTANTS`, so these defaults get skipped.
+#if ! defined(KALEIDOGLYPH_GLUKEYS_PACKED_MODIFIER_CONSTANTS)
+namespace kaleidoglyph {
+namespace glukeys {
+
+// Packed modifier glukeys use the spare modifier bits to hold a set of left-hand modifiers
+// (one bit each for Control, Shift, Alt & GUI), all of which become sticky together as a
+// single glukey. The `10` in the middle keeps these distinct from both single modifiers
+// and the special glukeys (meta & cancel).
+constexpr byte packed_modifier_id   { modifier_category_id | 0b00'10'0000 };
+constexpr byte packed_modifier_category_mask { category_mask | 0b00'11'0000 };
+constexpr byte packed_modifier_mask { 0b00'00'1111 };
+
+}  // namespace qukeys
+}  // namespace kaleidoglyph
+#endif
+
 namespace kaleidoglyph {
 namespace glukeys {
 
@@ -43,16 +60,32 @@ bool isGlukeysKey(Key key) {
   return { GlukeysKey::verifyType(key) };
 }
 
+// Return the `Key` for a set of packed modifiers: the lowest one as the keycode, and the
+// rest as modifier flags, so the whole set gets added to (and removed from) the report by
+// a single key.
+inline
+Key packedModifierKey(byte modifiers) {
+  if (modifiers == 0) {
+    return cKey::blank;
+  }
+  byte first = __builtin_ctz(modifiers);
+  return KeyboardKey(byte(KeyboardKey::mod_keycode_offset + first),
+                     byte(modifiers & (modifiers - 1)));
+}
+
 // Return a `Key` determined by the index bits of the GlukeysKey. Possible return values
-// are: a keyboard modifier key, a layer-shift key, an indicator that this key can be used
-// to look up a `Key` value in the `glukeys_[]` array (`cKey::clear`), and an indicator
-// that this GlukeysKey is invalid (`cKey::blank`).
+// are: a keyboard modifier key (or set of modifiers), a layer-shift key, an indicator
+// that this key can be used to look up a `Key` value in the `glukeys_[]` array
+// (`cKey::clear`), and an indicator that this GlukeysKey is invalid (`cKey::blank`).
 inline
 Key getKey(GlukeysKey glukeys_key) {
   byte index = glukeys_key.data();
   byte category_id = index & category_mask;
   switch (category_id) {
     case modifier_category_id :
+      if ((index & packed_modifier_category_mask) == packed_modifier_id) {
+        return packedModifierKey(index & packed_modifier_mask);
+      }
       return modifierKey(index & modifier_mask);
     case layer_category_id :
       return layerShiftKey(index & layer_mask);
@@ -72,6 +105,20 @@ GlukeysKey glukeysModifierKey(KeyboardKey key) {
   return ( glukeysModifierKey(key.keycode() - KeyboardKey::mod_keycode_offset) );
 }
 
+// Bits for building packed modifier glukeys, e.g.:
+//   glukeysModifiersKey(cGlukeysModifier::control | cGlukeysModifier::shift)
+namespace cGlukeysModifier {
+constexpr byte control { 0b0001 };
+constexpr byte shift   { 0b0010 };
+constexpr byte alt     { 0b0100 };
+constexpr byte gui     { 0b1000 };
+}
+
+constexpr
+GlukeysKey glukeysModifiersKey(byte modifiers) {
+  return ( GlukeysKey{ byte(packed_modifier_id | (packed_modifier_mask & modifiers)) } );
+}
+
 constexpr
 GlukeysKey glukeysLayerShiftKey(byte n) {
   return ( GlukeysKey{ byte(layer_category_id | (layer_mask & n)) } );
@@ -91,5 +138,81 @@ constexpr Key meta    = Key( cGlukeysKey::meta_glukey );
 constexpr Key cancel  = Key( cGlukeysKey::esc_glukey  );
 }
 
+// Return `true` if `index` (the data bits of a GlukeysKey) refers to an entry in the
+// `glukeys_[]` array, rather than a modifier, a layer shift, or nothing at all
+constexpr
+bool isTableIndex(byte index) {
+  return { (index & category_mask) == glukey_category_id };
+}
+
+// Return `false` if `key` is a GlukeysKey that doesn't decode to anything, or that refers
+// past the end of a `glukeys_[]` array with `glukey_count` entries. All other keys are
+// valid.
+constexpr
+bool isValidGlukeysKey(Key key, byte glukey_count) {
+  if (! isGlukeysKey(key) || key == cGlukey::meta || key == cGlukey::cancel) {
+    return true;
+  }
+  byte index = GlukeysKey{key}.data();
+  switch (index & category_mask) {
+    case modifier_category_id :
+      return ((index & packed_modifier_category_mask) != packed_modifier_id ||
+              (index & packed_modifier_mask) != 0);
+    case layer_category_id :
+      return true;
+    case glukey_category_id :
+      return index < glukey_count;
+    default:
+      return false;
+  }
+}
+
+// Check every `Key` in a keymap (or any other array of keys) against a `glukeys_[]`
+// array. If the keymap is `constexpr`, this can be used in a `static_assert()` in the
+// sketch:
+//
+//   static_assert(glukeys::isValidKeymap(keymap, glukey_table),
+//                 "Keymap has GlukeysKey entries beyond the end of the glukeys table");
+template<uint16_t _key_count, byte _glukey_count>
+constexpr
+bool isValidKeymap(const Key (&keys)[_key_count],
+                   const Key (&)[_glukey_count]) {
+  for (uint16_t i = 0; i < _key_count; ++i) {
+    if (! isValidGlukeysKey(keys[i], _glukey_count)) {
+      return false;
+    }
+  }
+  return true;
+}
+template<byte _layer_count, uint16_t _key_count, byte _glukey_count>
+constexpr
+bool isValidKeymap(const Key (&keymap)[_layer_count][_key_count],
+                   const Key (&glukeys)[_glukey_count]) {
+  for (byte layer = 0; layer < _layer_count; ++layer) {
+    if (! isValidKeymap(keymap[layer], glukeys)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// A glukeys table that has been checked against a (`constexpr`) keymap at compile time.
+// With `KALEIDOGLYPH_GLUKEYS_VALIDATED_KEYMAP` defined, the plugin doesn't check GlukeysKey
+// indices against the size of its table, so this is the only way to give it one:
+//
+//   glukeys::Plugin glukeys{glukeys::ValidatedKeymap<keymap, glukey_table>{}, controller};
+//
+// The keymap & table are `auto` template parameters, which need C++17, so that option
+// does too. Without it, the plugin checks indices at runtime instead.
+#if __cplusplus >= 201703L
+template<const auto& _keymap, const auto& _glukeys>
+struct ValidatedKeymap {
+  static_assert(isValidKeymap(_keymap, _glukeys),
+                "Keymap has GlukeysKey entries beyond the end of the glukeys table");
+};
+#elif defined(KALEIDOGLYPH_GLUKEYS_VALIDATED_KEYMAP)
+#error "KALEIDOGLYPH_GLUKEYS_VALIDATED_KEYMAP needs C++17 (-std=gnu++17)"
+#endif
+
 }  // namespace qukeys
 }  // namespace kaleidoglyph
@@ -10,16 +10,19 @@ namespace glukeys {
 static constexpr Color sticky_color{100, 200, 50};
 static constexpr Color locked_color{200, 50, 100};
 
+// The glukeys plugin calls `hooks::setLedForeground()` for each key whose state has
+// changed, so this only needs to look up the state of that one key.
 bool LedMode::setForegroundColor(KeyAddr k) {
-  if (glukeys_plugin_.isSticky(k)) {
-    kaleidoglyph::LedMode::manager().setKeyColor(k, sticky_color);
-    return true;
+  switch (glukeys_plugin_.state(k)) {
+    case State::sticky :
+      kaleidoglyph::LedMode::manager().setKeyColor(k, sticky_color);
+      return true;
+    case State::locked :
+      kaleidoglyph::LedMode::manager().setKeyColor(k, locked_color);
+      return true;
+    default:
+      return false;
   }
-  if (glukeys_plugin_.isLocked(k)) {
-    kaleidoglyph::LedMode::manager().setKeyColor(k, locked_color);
-    return true;
-  }
-  return false;
 }
 
 } // namespace glukeys {
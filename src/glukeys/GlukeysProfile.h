@@ -0,0 +1,31 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <Arduino.h>
+
+#include <kaleidoglyph/Key.h>
+#include <kaleidoglyph/KeyAddr.h>
+
+namespace kaleidoglyph {
+namespace glukeys {
+
+// The number of glukeys a profile can hold. Each one uses a bit of `sticky_mask`.
+constexpr byte max_profile_glukeys{8};
+
+// A saved set of `sticky` & `locked` glukeys, made by `Plugin::saveProfile()` (or written
+// out by hand in the sketch), and put back in place by `Plugin::restoreProfile()`.
+// `pending` glukeys aren't included, because they're still being held.
+struct Profile {
+  KeyAddr addrs[max_profile_glukeys];
+  // The active (looked-up) value of each glukey
+  Key     keys[max_profile_glukeys];
+  // Bit `n` is set if entry `n` is `sticky`, and clear if it's `locked`
+  byte    sticky_mask;
+  byte    count;
+};
+
+static_assert(max_profile_glukeys <= 8, "Profile::sticky_mask is too small");
+
+} // namespace glukeys {
+} // namespace kaleidoglyph {
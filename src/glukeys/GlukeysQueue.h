@@ -0,0 +1,59 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <Arduino.h>
+
+#include <kaleidoglyph/KeyAddr.h>
+
+namespace kaleidoglyph {
+namespace glukeys {
+
+// A fixed-size ring buffer of `KeyAddr` values
+template<byte _capacity>
+class KeyAddrQueue {
+
+ public:
+  static constexpr byte capacity = _capacity;
+
+  bool isEmpty() const {
+    return count_ == 0;
+  }
+  bool isFull() const {
+    return count_ == capacity;
+  }
+  byte size() const {
+    return count_;
+  }
+
+  // The caller must check `isFull()` first
+  void push(KeyAddr k) {
+    addrs_[(head_ + count_) % capacity] = k;
+    ++count_;
+  }
+  // The caller must check `isEmpty()` first
+  KeyAddr pop() {
+    KeyAddr k = addrs_[head_];
+    head_ = (head_ + 1) % capacity;
+    --count_;
+    return k;
+  }
+
+  // The `i`th entry, counting from the front of the queue
+  KeyAddr operator[](byte i) const {
+    return addrs_[(head_ + i) % capacity];
+  }
+
+  void clear() {
+    head_  = 0;
+    count_ = 0;
+  }
+
+ private:
+  KeyAddr addrs_[capacity];
+  byte head_{0};
+  byte count_{0};
+};
+
+} // namespace glukeys {
+} // namespace kaleidoglyph {
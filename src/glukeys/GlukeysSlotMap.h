@@ -0,0 +1,98 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <Arduino.h>
+
+#include <kaleidoglyph/Key.h>
+#include <kaleidoglyph/KeyAddr.h>
+#include <kaleidoglyph/hardware/Keyboard.h>
+
+#include "glukeys/GlukeysKey.h"
+
+namespace kaleidoglyph {
+namespace glukeys {
+
+// A mapping between `KeyAddr`s and a small number of glukey state slots, for keyboards
+// where only a few keys can ever become glukeys. Keys that don't have a slot map to
+// `_slot_count`. This is meant to be built at compile time (by one of the
+// `makeSlotMap()` functions below) and stored in PROGMEM.
+template<byte _slot_count>
+struct SlotMap {
+  byte slots[total_keys];
+  byte addrs[_slot_count];
+};
+
+// Build a `SlotMap` from a list of the addresses of keys that can become glukeys
+template<byte _slot_count, byte _addr_count>
+constexpr
+SlotMap<_slot_count> makeSlotMap(const KeyAddr (&addrs)[_addr_count]) {
+  static_assert(_addr_count <= _slot_count, "Too many addresses for glukeys state slots");
+  SlotMap<_slot_count> map{};
+  for (byte k = 0; k < total_keys; ++k) {
+    map.slots[k] = _slot_count;
+  }
+  for (byte i = 0; i < _addr_count; ++i) {
+    map.slots[addrs[i].addr()] = i;
+    map.addrs[i] = addrs[i].addr();
+  }
+  return map;
+}
+
+// Return `true` if any layer of `keymap` has a GlukeysKey at address `k`
+template<byte _layer_count>
+constexpr
+bool hasGlukeysKey(const Key (&keymap)[_layer_count][total_keys], byte k) {
+  for (byte layer = 0; layer < _layer_count; ++layer) {
+    if (isGlukeysKey(keymap[layer][k])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Count the addresses in `keymap` that have a GlukeysKey on any layer
+template<byte _layer_count>
+constexpr
+byte countGlukeysAddrs(const Key (&keymap)[_layer_count][total_keys]) {
+  byte count{0};
+  for (byte k = 0; k < total_keys; ++k) {
+    if (hasGlukeysKey(keymap, k)) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+#if __cplusplus >= 201703L
+// Build a `SlotMap` with a slot for every address in `_keymap` that has a GlukeysKey on
+// any layer. The keymap is a template argument (so it has to be `constexpr`), so that a
+// keymap with more of those addresses than there are slots doesn't compile, instead of
+// leaving some of its GlukeysKeys without state:
+//
+//   glukeys::makeSlotMap<glukeys::state_slot_count, keymap>()
+//
+// Auto-modifier and auto-layer keys aren't GlukeysKeys, so if those are used, their
+// addresses need to be listed explicitly instead. This needs C++17 (for the `auto`
+// template parameter); before that, only the list of addresses can be used.
+template<byte _slot_count, const auto& _keymap>
+constexpr
+SlotMap<_slot_count> makeSlotMap() {
+  static_assert(countGlukeysAddrs(_keymap) <= _slot_count,
+                "Not enough glukeys state slots for the GlukeysKeys in keymap");
+  SlotMap<_slot_count> map{};
+  byte slot{0};
+  for (byte k = 0; k < total_keys; ++k) {
+    map.slots[k] = _slot_count;
+    if (hasGlukeysKey(_keymap, k)) {
+      map.slots[k] = slot;
+      map.addrs[slot] = k;
+      ++slot;
+    }
+  }
+  return map;
+}
+#endif
+
+} // namespace glukeys {
+} // namespace kaleidoglyph {
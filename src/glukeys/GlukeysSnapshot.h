@@ -0,0 +1,88 @@
+// -*- c++ -*-
+
+#pragma once
+
+// Define `KALEIDOGLYPH_GLUKEYS_SNAPSHOT` to have the plugin publish a copy of its state
+// once per scan, for code that can't safely call `Plugin::state()` while the plugin might
+// be changing it: an interrupt handler, or (on a dual-core MCU) the other core. Readers
+// never block the plugin; if they catch it in the middle of publishing, they just try
+// again (or give up, in an interrupt handler).
+#if defined(KALEIDOGLYPH_GLUKEYS_SNAPSHOT)
+
+#include <Arduino.h>
+
+namespace kaleidoglyph {
+namespace glukeys {
+
+// A seqlock: the version is odd while a new copy is being written, and each word is
+// loaded & stored atomically, so a reader can tell if it got a consistent copy by
+// checking that the version was even, and didn't change, while it was reading. There's
+// only ever one writer (the plugin).
+//
+// Instead of fences, the words themselves are stored with release & loaded with acquire
+// ordering: a reader that sees any new word also sees the odd version that was stored
+// before it, and can't read the version for its final check until it has read all the
+// words. On a single-core MCU, that costs nothing more than a compiler barrier, and it
+// lets the thread sanitizer check it on a host.
+template<typename _Bitfield>
+class StateSnapshot {
+
+  typedef typename _Bitfield::word_type Word;
+
+ public:
+  // The version counter is the same size as a bitfield word, so it can be read & written
+  // atomically without disabling interrupts, even on AVR.
+  typedef Word Version;
+
+  struct Copy {
+    _Bitfield temp_bits;
+    _Bitfield glue_bits;
+    Version   version;
+  };
+
+  // Writer only
+  void publish(const _Bitfield& temp_bits, const _Bitfield& glue_bits) {
+    Version version = __atomic_load_n(&version_, __ATOMIC_RELAXED);
+    __atomic_store_n(&version_, Version(version + 1), __ATOMIC_RELAXED);
+    for (byte w = 0; w < _Bitfield::word_count; ++w) {
+      __atomic_store_n(&temp_words_[w], temp_bits.word(w), __ATOMIC_RELEASE);
+      __atomic_store_n(&glue_words_[w], glue_bits.word(w), __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&version_, Version(version + 2), __ATOMIC_RELEASE);
+  }
+
+  // Make one attempt to read a consistent copy. Returns `false` if the plugin was
+  // publishing at the same time. An interrupt handler must use this, rather than
+  // `read()`, because the publish it interrupted can't finish until it returns.
+  bool tryRead(Copy& copy) const {
+    Version version = __atomic_load_n(&version_, __ATOMIC_ACQUIRE);
+    if (version & 1) {
+      return false;
+    }
+    for (byte w = 0; w < _Bitfield::word_count; ++w) {
+      copy.temp_bits.word(w) = __atomic_load_n(&temp_words_[w], __ATOMIC_ACQUIRE);
+      copy.glue_bits.word(w) = __atomic_load_n(&glue_words_[w], __ATOMIC_ACQUIRE);
+    }
+    if (__atomic_load_n(&version_, __ATOMIC_RELAXED) != version) {
+      return false;
+    }
+    copy.version = version;
+    return true;
+  }
+
+  // Read a consistent copy, retrying until the plugin isn't publishing. For other cores
+  // and threads only.
+  void read(Copy& copy) const {
+    while (! tryRead(copy)) {}
+  }
+
+ private:
+  Version version_{0};
+  Word    temp_words_[_Bitfield::word_count];
+  Word    glue_words_[_Bitfield::word_count];
+};
+
+} // namespace glukeys {
+} // namespace kaleidoglyph {
+
+#endif
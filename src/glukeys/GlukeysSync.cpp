@@ -0,0 +1,59 @@
+// -*- c++ -*-
+
+#include "glukeys/GlukeysSync.h"
+
+#if defined(KALEIDOGLYPH_GLUKEYS_WITH_SYNC)
+
+#include <Arduino.h>
+
+#include <kaleidoglyph/KeyAddr.h>
+
+
+namespace kaleidoglyph {
+namespace glukeys {
+
+SyncUpdate SyncDecoder::feed(byte b) {
+  switch (step_) {
+    case Step::header : {
+      byte seq = b & sync_seq_mask;
+      bool in_order = (seq == expected_seq_);
+      expected_seq_ = (seq + 1) & sync_seq_mask;
+      if (b & sync_full_flag) {
+        step_ = Step::full_count;
+      } else {
+        // A gap in the sequence means a lost message, so the state is unknown until the
+        // next full state message
+        in_sync_ = in_sync_ && in_order;
+        state_ = (b & sync_state_mask) >> sync_state_shift;
+        step_ = Step::delta_addr;
+      }
+      return SyncUpdate::none;
+    }
+    case Step::delta_addr :
+      step_ = Step::header;
+      if (! in_sync_) {
+        return SyncUpdate::none;
+      }
+      addr_ = KeyAddr{b};
+      return SyncUpdate::state;
+    case Step::full_count :
+      remaining_ = b;
+      in_sync_ = true;
+      step_ = (remaining_ == 0) ? Step::header : Step::full_addr;
+      return SyncUpdate::reset;
+    case Step::full_addr :
+      addr_ = KeyAddr{b};
+      step_ = Step::full_state;
+      return SyncUpdate::none;
+    case Step::full_state :
+      state_ = b;
+      step_ = (--remaining_ == 0) ? Step::header : Step::full_addr;
+      return SyncUpdate::state;
+  }
+  return SyncUpdate::none;
+}
+
+} // namespace glukeys {
+} // namespace kaleidoglyph {
+
+#endif
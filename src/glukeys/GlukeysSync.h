@@ -0,0 +1,201 @@
+// -*- c++ -*-
+
+#pragma once
+
+// Define `KALEIDOGLYPH_GLUKEYS_WITH_SYNC` to make glukeys state available to another
+// device (e.g. the other half of a split keyboard, or a host-side companion). The plugin
+// encodes every state change into a small buffer, which the sketch sends over whatever
+// link it has; on the other side, the received bytes are fed back into that device's
+// glukeys plugin.
+#if defined(KALEIDOGLYPH_GLUKEYS_WITH_SYNC)
+
+#include <Arduino.h>
+
+#include <kaleidoglyph/KeyAddr.h>
+
+namespace kaleidoglyph {
+namespace glukeys {
+
+// Message format. Every message starts with a header byte:
+//
+//   bit 7:    0 = delta, 1 = full state
+//   bits 6-5: new state (delta only; same encoding as `glukeys::State`)
+//   bits 4-0: sequence number
+//
+// A delta is followed by one byte: the `KeyAddr` whose state changed. A full state
+// message is followed by a count, and then that many pairs of `KeyAddr` & state bytes;
+// any key not listed is `clear`. If the receiver sees a gap in the sequence numbers, it
+// ignores deltas until the next full state message, which the sender sends periodically.
+//
+// Messages are only ever lost when the sender drops them, because the link couldn't keep
+// up. The sender then skips a sequence number, so the gap is always visible, even if the
+// number of messages dropped is a multiple of 32.
+constexpr byte sync_full_flag{0b1'00'00000};
+constexpr byte sync_state_mask{0b0'11'00000};
+constexpr byte sync_state_shift{5};
+constexpr byte sync_seq_mask{0b0'00'11111};
+
+// The number of bytes of deltas the encoder's buffer has room for, on top of a full
+// state message listing every key (see `sync_buffer_size` in `Glukeys.h`)
+constexpr byte sync_delta_space{16};
+
+// Send a full state message at least this often (ms)
+constexpr uint16_t sync_resync_interval{1000};
+
+// The encoder's buffer holds `_buffer_size` outgoing bytes, which must be enough for the
+// largest possible full state message, so a resync never has to wait for more room than
+// the buffer has.
+template<byte _buffer_size>
+class SyncEncoder {
+
+ public:
+  // Record that key `k` is now in `state`
+  void recordChange(KeyAddr k, byte state) {
+    if (muted_) return;
+
+    // If the link can't keep up, drop all the messages that are waiting, and send the
+    // full state instead, once there's room. A message that `read()` has already started
+    // on is kept, because the receiver has part of it; the dropped ones leave a gap in
+    // the sequence numbers, so the receiver knows to wait for the full state.
+    if (space() < 2) {
+      count_ = partial_count_;
+      seq_ = read_seq_ + 1;
+      resync_pending_ = true;
+      return;
+    }
+    push(nextHeader(byte(state << sync_state_shift) & sync_state_mask));
+    push(k.addr());
+  }
+
+  // Is it time to send a full state message?
+  bool isResyncDue(uint16_t current_time) const {
+    return timeUntilResync(current_time) == 0;
+  }
+  void requestResync() {
+    resync_pending_ = true;
+  }
+  // The number of ms until a full state message is due (0 if it's due now)
+  uint16_t timeUntilResync(uint16_t current_time) const {
+    uint16_t elapsed = current_time - last_resync_time_;
+    if (resync_pending_ || elapsed >= sync_resync_interval) {
+      return 0;
+    }
+    return sync_resync_interval - elapsed;
+  }
+
+  // Start a full state message with `count` entries. Returns `false` if there isn't room
+  // in the buffer (yet), in which case the resync stays pending.
+  bool beginFullState(byte count, uint16_t current_time) {
+    if (space() < 2 + 2 * count) {
+      resync_pending_ = true;
+      return false;
+    }
+    push(nextHeader(sync_full_flag));
+    push(count);
+    resync_pending_ = false;
+    last_resync_time_ = current_time;
+    return true;
+  }
+  void appendFullState(KeyAddr k, byte state) {
+    push(k.addr());
+    push(state);
+  }
+
+  // While muted (i.e. while applying changes received from the other side), changes
+  // aren't recorded
+  void mute(bool muted) {
+    muted_ = muted;
+  }
+
+  // Copy up to `max` bytes of outgoing messages to `buffer`, returning the number copied.
+  // A message can be split between calls.
+  byte read(byte* buffer, byte max) {
+    byte n{0};
+    while (n < max && count_ != 0) {
+      if (partial_count_ == 0) {
+        // Starting a new message. Messages are always written whole, so if it's a full
+        // state message, its count is in the buffer, too.
+        partial_count_ = 2;
+        read_seq_ = (buffer_[head_] + 1) & sync_seq_mask;
+        if (buffer_[head_] & sync_full_flag) {
+          partial_count_ += 2 * buffer_[(head_ + 1) % _buffer_size];
+        }
+      }
+      buffer[n++] = buffer_[head_];
+      head_ = (head_ + 1) % _buffer_size;
+      --count_;
+      --partial_count_;
+    }
+    return n;
+  }
+
+ private:
+  byte buffer_[_buffer_size];
+  byte head_{0};
+  byte count_{0};
+  // The number of bytes of the message at `head_` that are left to read, if `read()`
+  // has started on it
+  byte partial_count_{0};
+
+  byte seq_{0};
+  // The sequence number the receiver expects next: the one after the last message that
+  // `read()` has started on
+  byte read_seq_{0};
+  bool muted_{false};
+  bool resync_pending_{true};
+  uint16_t last_resync_time_{0};
+
+  byte space() const {
+    return _buffer_size - count_;
+  }
+  void push(byte b) {
+    buffer_[(head_ + count_) % _buffer_size] = b;
+    ++count_;
+  }
+  byte nextHeader(byte flags) {
+    byte header = flags | (seq_ & sync_seq_mask);
+    ++seq_;
+    return header;
+  }
+};
+
+// What `SyncDecoder::feed()` found
+enum class SyncUpdate : byte {
+  none,   // nothing yet
+  reset,  // a full state message started; everything should be cleared
+  state,  // `addr()` is now in `state()`
+};
+
+class SyncDecoder {
+
+ public:
+  SyncUpdate feed(byte b);
+
+  KeyAddr addr() const {
+    return addr_;
+  }
+  byte state() const {
+    return state_;
+  }
+
+ private:
+  enum class Step : byte {
+    header,
+    delta_addr,
+    full_count,
+    full_addr,
+    full_state,
+  };
+
+  Step step_{Step::header};
+  byte expected_seq_{0};
+  bool in_sync_{false};
+  byte remaining_{0};
+  KeyAddr addr_;
+  byte state_{0};
+};
+
+} // namespace glukeys {
+} // namespace kaleidoglyph {
+
+#endif
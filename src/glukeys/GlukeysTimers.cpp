@@ -0,0 +1,125 @@
+// -*- c++ -*-
+
+#include "glukeys/GlukeysTimers.h"
+
+#include <Arduino.h>
+
+#include <kaleidoglyph/KeyAddr.h>
+
+
+namespace kaleidoglyph {
+namespace glukeys {
+
+void TimerWheel::schedule(KeyAddr k, uint16_t deadline, uint16_t current_time) {
+  cancel(k);
+
+  // If all the timers are in use, this glukey won't time out
+  if (free_head_ == no_timer) return;
+
+  // If the wheel was idle, the cursor may be far behind the clock; bring it up to date
+  // so the next call to `popExpired()` doesn't have to catch up.
+  if (isEmpty()) {
+    cursor_tick_ = tick(current_time);
+  }
+
+  byte i = free_head_;
+  free_head_ = timers_[i].next;
+  ++active_count_;
+
+  byte slot = slotFor(deadline);
+  timers_[i].addr     = k;
+  timers_[i].deadline = deadline;
+  timers_[i].next     = slot_heads_[slot];
+  slot_heads_[slot]   = i;
+}
+
+
+void TimerWheel::cancel(KeyAddr k) {
+  for (byte i = 0; i < timer_count; ++i) {
+    if (timers_[i].addr != k) continue;
+
+    // Unlink the timer from its slot's list, and add it to the free list
+    byte* link = &slot_heads_[slotFor(timers_[i].deadline)];
+    while (*link != i) {
+      link = &timers_[*link].next;
+    }
+    *link = timers_[i].next;
+    freeTimer(i);
+    return;
+  }
+}
+
+
+void TimerWheel::clear() {
+  for (byte slot = 0; slot < timer_slot_count; ++slot) {
+    slot_heads_[slot] = no_timer;
+  }
+  for (byte i = 0; i < timer_count; ++i) {
+    timers_[i].addr = cKeyAddr::invalid;
+    timers_[i].next = byte(i + 1);
+  }
+  timers_[timer_count - 1].next = no_timer;
+  free_head_ = 0;
+  active_count_ = 0;
+}
+
+
+KeyAddr TimerWheel::popExpired(uint16_t current_time) {
+  if (isEmpty()) return cKeyAddr::invalid;
+
+  byte current_tick = tick(current_time);
+
+  // If the scan loop was stalled for longer than a full turn of the wheel, there's no
+  // point visiting any slot more than once.
+  if (byte(current_tick - cursor_tick_) > timer_slot_count) {
+    cursor_tick_ = current_tick - timer_slot_count;
+  }
+
+  while (cursor_tick_ != current_tick) {
+    byte* link = &slot_heads_[byte(cursor_tick_ + 1) % timer_slot_count];
+    while (*link != no_timer) {
+      Timer& timer = timers_[*link];
+      // Timers with a deadline more than one turn of the wheel away stay in place until
+      // the cursor comes around again.
+      if (int16_t(current_time - timer.deadline) > 0) {
+        KeyAddr k = timer.addr;
+        byte i = *link;
+        *link = timer.next;
+        freeTimer(i);
+        // Leave `cursor_tick_` where it is; this slot might have more expired timers.
+        return k;
+      }
+      link = &timer.next;
+    }
+    ++cursor_tick_;
+  }
+  return cKeyAddr::invalid;
+}
+
+
+uint16_t TimerWheel::timeUntilNextExpiry(uint16_t current_time) const {
+  uint16_t result = no_deadline;
+  for (byte i = 0; i < timer_count; ++i) {
+    if (! timers_[i].addr.isValid()) continue;
+    // A timer is collected when the cursor reaches the tick after its deadline
+    uint16_t due_time = ((timers_[i].deadline >> timer_tick_bits) + 1) << timer_tick_bits;
+    int16_t remaining = int16_t(due_time - current_time);
+    if (remaining <= 0) return 0;
+    if (uint16_t(remaining) < result) {
+      result = remaining;
+    }
+  }
+  return result;
+}
+
+
+// Return timer `i`, which must already be unlinked from its slot, to the free list
+void TimerWheel::freeTimer(byte i) {
+  timers_[i].addr = cKeyAddr::invalid;
+  timers_[i].next = free_head_;
+  free_head_ = i;
+  --active_count_;
+}
+
+} // namespace glukeys {
+} // namespace kaleidoglyph {
@@ -0,0 +1,90 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <Arduino.h>
+
+#include <kaleidoglyph/KeyAddr.h>
+
+namespace kaleidoglyph {
+namespace glukeys {
+
+// The maximum number of `pending` & `sticky` glukeys that can have a timeout running at
+// the same time. If more than this many are active, the extra ones will only be released
+// by their trigger key.
+constexpr byte timer_count{8};
+
+// The timer wheel has this many slots, each covering `1 << timer_tick_bits` ms. Expired
+// glukeys are released up to one tick late.
+constexpr byte timer_slot_count{8};
+constexpr byte timer_tick_bits{6};
+
+// Returned by `timeUntilNextExpiry()` when there are no timers running
+constexpr uint16_t no_deadline{0xFFFF};
+
+// A small fixed-size timer wheel for glukey timeouts. Each timer is hung on the slot for
+// the tick following its deadline, so checking for expired timers costs nothing until the
+// clock reaches a new tick, and then only that slot's timers are examined.
+class TimerWheel {
+
+ public:
+  TimerWheel() {
+    clear();
+  }
+
+  // Start (or restart) the timer for `k`, expiring at `deadline`
+  void schedule(KeyAddr k, uint16_t deadline, uint16_t current_time);
+
+  // Stop the timer for `k`, if it has one
+  void cancel(KeyAddr k);
+
+  // Stop all timers
+  void clear();
+
+  // Remove one expired timer and return its `KeyAddr`, or return `cKeyAddr::invalid` if
+  // no timer has expired as of `current_time`. Call this repeatedly until it returns an
+  // invalid address to collect all expired timers.
+  KeyAddr popExpired(uint16_t current_time);
+
+  bool isEmpty() const {
+    return active_count_ == 0;
+  }
+
+  // The number of ms from `current_time` until `popExpired()` will next return a timer,
+  // or `no_deadline` if there are no timers running
+  uint16_t timeUntilNextExpiry(uint16_t current_time) const;
+
+ private:
+  static constexpr byte no_timer{0xFF};
+
+  struct Timer {
+    KeyAddr  addr;
+    byte     next;
+    uint16_t deadline;
+  };
+
+  Timer timers_[timer_count];
+
+  // The first timer in each slot's list, or `no_timer`
+  byte slot_heads_[timer_slot_count];
+
+  // Head of the list of unused timers
+  byte free_head_;
+
+  // The last tick whose slot has been fully processed
+  byte cursor_tick_{0};
+
+  // The number of timers in use
+  byte active_count_{0};
+
+  static byte tick(uint16_t time) {
+    return byte(time >> timer_tick_bits);
+  }
+  static byte slotFor(uint16_t deadline) {
+    return byte(tick(deadline) + 1) % timer_slot_count;
+  }
+  void freeTimer(byte i);
+};
+
+} // namespace glukeys {
+} // namespace kaleidoglyph {
@@ -0,0 +1,132 @@
+// -*- c++ -*-
+
+#include "glukeys/GlukeysTrace.h"
+
+#if defined(KALEIDOGLYPH_GLUKEYS_TRACE)
+
+#include <Arduino.h>
+
+#include <kaleidoglyph/Controller.h>
+#include <kaleidoglyph/KeyAddr.h>
+
+
+namespace kaleidoglyph {
+namespace glukeys {
+
+// The names are only used by `dump()`, so they're kept in PROGMEM, along with the tables
+// of pointers to them.
+static const char trace_clear_name[]       PROGMEM = "clear";
+static const char trace_pending_name[]     PROGMEM = "pending";
+static const char trace_locked_name[]      PROGMEM = "locked";
+static const char trace_sticky_name[]      PROGMEM = "sticky";
+static const char trace_trigger_name[]     PROGMEM = "trigger";
+static const char trace_timeout_name[]     PROGMEM = "timeout";
+static const char trace_release_name[]     PROGMEM = "release";
+static const char trace_release_all_name[] PROGMEM = "release_all";
+
+static const char* const trace_event_names[] PROGMEM = {
+  trace_clear_name, trace_pending_name, trace_locked_name, trace_sticky_name,
+  trace_trigger_name, trace_timeout_name, trace_release_name, trace_release_all_name,
+};
+
+static const char release_rollover_name[]   PROGMEM = "rollover";
+static const char release_cancel_name[]     PROGMEM = "cancel";
+static const char release_deactivate_name[] PROGMEM = "deactivate";
+
+static const char* const release_cause_names[] PROGMEM = {
+  trace_trigger_name, release_rollover_name, release_cancel_name, release_deactivate_name,
+};
+
+// Get a name from one of the tables above, for printing
+static const __FlashStringHelper* traceName(const char* const names[], byte i) {
+  return reinterpret_cast<const __FlashStringHelper*>(pgm_read_ptr(&names[i]));
+}
+
+
+void Trace::record(TraceEvent event, KeyAddr k) {
+  Record& record = records_[next_record_];
+  record.time  = Controller::scanStartTime();
+  record.addr  = k;
+  record.event = event;
+  next_record_ = (next_record_ + 1) % trace_buffer_size;
+  if (record_count_ < trace_buffer_size) {
+    ++record_count_;
+  }
+}
+
+
+void Trace::startTrigger() {
+  trigger_start_time_ = Controller::scanStartTime();
+}
+
+void Trace::stopTrigger() {
+  uint16_t elapsed_time = uint16_t(Controller::scanStartTime()) - trigger_start_time_;
+  ++trigger_count_;
+  trigger_total_time_ += elapsed_time;
+  if (elapsed_time > trigger_max_time_) {
+    trigger_max_time_ = elapsed_time;
+  }
+}
+
+
+void Trace::countEventTime(uint16_t elapsed_micros) {
+  byte bucket{0};
+  for (uint16_t t = elapsed_micros >> 3;
+       t != 0 && bucket < event_time_bucket_count - 1;
+       t >>= 1) {
+    ++bucket;
+  }
+  ++event_time_histogram_[bucket];
+}
+
+
+void Trace::dump(Print& out) const {
+  out.println(F("glukeys trace:"));
+  byte first = (next_record_ + trace_buffer_size - record_count_) % trace_buffer_size;
+  for (byte n = 0; n < record_count_; ++n) {
+    const Record& record = records_[(first + n) % trace_buffer_size];
+    out.print(record.time);
+    out.print(F(" "));
+    out.print(record.addr.addr());
+    out.print(F(" "));
+    out.println(traceName(trace_event_names, byte(record.event)));
+  }
+
+  out.println(F("glukeys releases:"));
+  for (byte cause = 0; cause < release_cause_count; ++cause) {
+    out.print(traceName(release_cause_names, cause));
+    out.print(F(" "));
+    out.println(release_counts_[cause]);
+  }
+  out.print(F("timeout "));
+  out.println(timeout_count_);
+
+  out.print(F("trigger ms avg "));
+  out.print(trigger_count_ == 0 ? 0 : trigger_total_time_ / trigger_count_);
+  out.print(F(" max "));
+  out.println(trigger_max_time_);
+
+  out.print(F("injected "));
+  out.println(injected_count_);
+
+  out.println(F("event time histogram (us < limit):"));
+  for (byte bucket = 0; bucket < event_time_bucket_count; ++bucket) {
+    if (bucket < event_time_bucket_count - 1) {
+      out.print(8UL << bucket);
+    } else {
+      out.print(F("more"));
+    }
+    out.print(F(" "));
+    out.println(event_time_histogram_[bucket]);
+  }
+}
+
+
+void Trace::reset() {
+  *this = Trace{};
+}
+
+} // namespace glukeys {
+} // namespace kaleidoglyph {
+
+#endif
@@ -0,0 +1,137 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <Arduino.h>
+
+#include <kaleidoglyph/KeyAddr.h>
+
+// Define `KALEIDOGLYPH_GLUKEYS_TRACE` to record what the glukeys state machine does, for
+// debugging. Without it, the `GLUKEYS_TRACE...()` macros compile to nothing, and the
+// plugin has no trace storage at all.
+#if defined(KALEIDOGLYPH_GLUKEYS_TRACE)
+
+namespace kaleidoglyph {
+namespace glukeys {
+
+// The number of events kept in the trace buffer; older events get overwritten
+constexpr byte trace_buffer_size{32};
+
+// Things that get recorded. The first four match the values of `glukeys::State`, and are
+// recorded whenever a key enters that state.
+enum class TraceEvent : byte {
+  clear,
+  pending,
+  locked,
+  sticky,
+  trigger,          // a key was set as the release trigger
+  timeout,          // a glukey timed out
+  release,          // an injected release event was sent
+  release_all,      // all `temp` glukeys were released or cleared
+};
+
+// Reasons for releasing glukeys with `releaseGlukeys()`
+enum class ReleaseCause : byte {
+  trigger,          // the trigger key was released
+  rollover,         // a new key was pressed while a trigger was still held
+  cancel,           // the cancel glukey was pressed
+  deactivate,       // the plugin was deactivated
+};
+constexpr byte release_cause_count{4};
+
+// The number of buckets in the `onKeyEvent()` processing time histogram. Bucket 0 counts
+// events that took less than 8 us, and each bucket after that doubles the limit, except
+// the last one, which counts everything else.
+constexpr byte event_time_bucket_count{8};
+
+class Trace {
+
+ public:
+  void record(TraceEvent event, KeyAddr k);
+
+  void countRelease(ReleaseCause cause) {
+    ++release_counts_[byte(cause)];
+  }
+  void countTimeout() {
+    ++timeout_count_;
+  }
+
+  // Called when a trigger key is pressed, and when it releases its glukeys, to measure
+  // the time between the two
+  void startTrigger();
+  void stopTrigger();
+
+  void countInjectedRelease() {
+    ++injected_count_;
+  }
+
+  // Add the processing time of one event to the histogram
+  void countEventTime(uint16_t elapsed_micros);
+
+  // Measures the time from its construction to its destruction, for timing
+  // `onKeyEvent()` regardless of where it returns
+  class EventTimer {
+   public:
+    explicit EventTimer(Trace& trace)
+        : trace_(trace), start_time_(micros()) {}
+    ~EventTimer() {
+      trace_.countEventTime(uint16_t(micros()) - start_time_);
+    }
+   private:
+    Trace&   trace_;
+    uint16_t start_time_;
+  };
+
+  // Print the recorded events (oldest first) and the counters
+  void dump(Print& out) const;
+
+  void reset();
+
+ private:
+  struct Record {
+    uint16_t   time;
+    KeyAddr    addr;
+    TraceEvent event;
+  };
+
+  Record records_[trace_buffer_size];
+  byte next_record_{0};
+  byte record_count_{0};
+
+  uint16_t release_counts_[release_cause_count]{};
+  uint16_t timeout_count_{0};
+
+  uint16_t trigger_start_time_{0};
+  uint16_t trigger_count_{0};
+  uint32_t trigger_total_time_{0};
+  uint16_t trigger_max_time_{0};
+
+  uint16_t injected_count_{0};
+
+  uint16_t event_time_histogram_[event_time_bucket_count]{};
+};
+
+} // namespace glukeys {
+} // namespace kaleidoglyph {
+
+#define GLUKEYS_TRACE(event, k) trace_.record(TraceEvent::event, k)
+#define GLUKEYS_TRACE_STATE(k) trace_.record(TraceEvent(state(k)), k)
+#define GLUKEYS_TRACE_RELEASE(cause) trace_.countRelease(ReleaseCause::cause)
+#define GLUKEYS_TRACE_TIMEOUT() trace_.countTimeout()
+#define GLUKEYS_TRACE_TRIGGER_START() trace_.startTrigger()
+#define GLUKEYS_TRACE_TRIGGER_STOP() trace_.stopTrigger()
+#define GLUKEYS_TRACE_INJECTED() trace_.countInjectedRelease()
+#define GLUKEYS_TRACE_EVENT_TIMER() Trace::EventTimer trace_event_timer{trace_}
+
+#else
+
+#define GLUKEYS_TRACE(event, k)
+#define GLUKEYS_TRACE_STATE(k)
+#define GLUKEYS_TRACE_RELEASE(cause)
+#define GLUKEYS_TRACE_TIMEOUT()
+#define GLUKEYS_TRACE_TRIGGER_START()
+#define GLUKEYS_TRACE_TRIGGER_STOP()
+#define GLUKEYS_TRACE_INJECTED()
+#define GLUKEYS_TRACE_EVENT_TIMER()
+
+#endif
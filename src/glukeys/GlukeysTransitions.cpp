@@ -0,0 +1,63 @@
+// -*- c++ -*-
+
+#include "glukeys/GlukeysTransitions.h"
+
+#include <Arduino.h>
+
+
+namespace kaleidoglyph {
+namespace glukeys {
+
+// The rows are indexed by `State`, in order: `clear`, `pending`, `locked`, `sticky`. A
+// `pending` key can't normally be pressed (it's already held), so if another plugin sends
+// that event, the key just becomes `clear`.
+const PROGMEM byte transition_table[behaviour_count][2][4] = {
+  // standard
+  {
+    { // press
+      transition(State::clear,  Action::press),
+      transition(State::clear,  Action::none),
+      transition(State::clear,  Action::none),
+      transition(State::locked, Action::none),
+    },
+    { // release
+      transition(State::clear,  Action::release),
+      transition(State::sticky, Action::remember_layer_shift),
+      transition(State::locked, Action::none),
+      transition(State::sticky, Action::none),
+    },
+  },
+  // double_tap_lock
+  {
+    { // press
+      transition(State::clear,  Action::press),
+      transition(State::clear,  Action::none),
+      transition(State::clear,  Action::none),
+      transition(State::locked, Action::double_tap),
+    },
+    { // release
+      transition(State::clear,  Action::release),
+      transition(State::sticky, Action::remember_layer_shift),
+      transition(State::locked, Action::none),
+      transition(State::sticky, Action::none),
+    },
+  },
+  // skip_sticky
+  {
+    { // press
+      transition(State::clear,  Action::press),
+      transition(State::clear,  Action::none),
+      transition(State::clear,  Action::none),
+      transition(State::locked, Action::none),
+    },
+    { // release
+      transition(State::clear,  Action::release),
+      transition(State::locked, Action::none),
+      transition(State::locked, Action::none),
+      transition(State::sticky, Action::none),
+    },
+  },
+};
+
+} // namespace glukeys {
+} // namespace kaleidoglyph {
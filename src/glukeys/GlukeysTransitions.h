@@ -0,0 +1,60 @@
+// -*- c++ -*-
+
+#pragma once
+
+#include <Arduino.h>
+
+namespace kaleidoglyph {
+namespace glukeys {
+
+// The state of a single glukey, made up of its `temp` bit (bit 0) and its `glue` bit
+// (bit 1)
+enum class State : byte {
+  clear   = 0b00,
+  pending = 0b01,
+  locked  = 0b10,
+  sticky  = 0b11,
+};
+
+// What happens when a key is pressed or released, in addition to its change of state
+enum class Action : byte {
+  none,
+  press,                // a `clear` key was pressed; it might become a glukey or a trigger
+  release,              // a `clear` key was released; it might be the release trigger
+  remember_layer_shift, // a layer-shift glukey just became `sticky`
+  double_tap,           // lock the `sticky` key if pressed again soon enough, or release it
+};
+
+// Alternative glukey behaviours, selected with `Plugin::setBehaviour()`
+enum class Behaviour : byte {
+  standard,         // tap: `sticky`; tap again: `locked`; tap again: `clear`
+  double_tap_lock,  // like `standard`, but a second tap only locks within a short window
+  skip_sticky,      // tap: `locked`; tap again: `clear`
+};
+constexpr byte behaviour_count{3};
+
+// The time (ms) from a glukey's first press to its second, within which the
+// `double_tap_lock` behaviour locks it. After that, the second tap releases it instead.
+constexpr uint16_t double_tap_window{400};
+
+// Each transition table entry is one byte: the next state in bits 0-1, and the action in
+// the rest
+constexpr byte transition(State next, Action action) {
+  return byte(next) | (byte(action) << 2);
+}
+constexpr State transitionState(byte entry) {
+  return State(entry & 0b11);
+}
+constexpr Action transitionAction(byte entry) {
+  return Action(entry >> 2);
+}
+
+// Events, as transition table indices
+constexpr byte press_event{0};
+constexpr byte release_event{1};
+
+// The transition table: [behaviour][event][state] => next state & action
+extern const PROGMEM byte transition_table[behaviour_count][2][4];
+
+} // namespace glukeys {
+} // namespace kaleidoglyph {